@@ -6,9 +6,11 @@
 progname=`basename $0`
 
 usage() {
-	echo Usage: "$progname" [-kSV] [-o file.bin] file.b	>&2
+	echo Usage: "$progname" [-ksSV] [-m model] [-o file.bin] file.b >&2
 	echo " -k  keep temporary files"			>&2
+	echo " -m  optimise for CPU model (8e, 8a)"		>&2
 	echo " -o  set output file name"			>&2
+	echo " -s  optimise for size instead of speed"		>&2
 	echo " -S  do not assemble"				>&2
 	echo " -V  print program version and exit"		>&2
 	exit 2
@@ -32,13 +34,17 @@ mvout() {
 }
 
 kflag=
+mflag=
 ofile=
+sflag=
 Sflag=
-while getopts ko:SV opt
+while getopts km:o:sSV opt
 do
 	case $opt in
 	k) kflag=1;;
+	m) mflag="-m $OPTARG";;
 	o) ofile="$OPTARG";;
+	s) sflag=-s;;
 	S) Sflag=1;;
 	V) version;;
 	?) usage;;
@@ -71,7 +77,7 @@ fi
 (
 	cat "%brtloc%"
 	echo
-	"%bc1loc%" <"$1"
+	"%bc1loc%" $sflag $mflag <"$1"
 ) >"$stem.pal"
 status=$?
 
@@ -11,6 +11,7 @@
 #include "error.h"
 #include "data.h"
 #include "name.h"
+#include "opt.h"
 
 /*
  * Labels related to the current function.
@@ -29,12 +30,20 @@
  *
  * retlabel
  *     points to the current function's leave instruction
+ *
+ * bodylabel
+ *     beginning of the function body, right after the prologue
+ *
+ * funlabel
+ *     the current function itself
  */
 static struct expr framelabel = { 0, "(FRAME)" };
 static struct expr paramlabel = { 0, "(PARAM)" };
 static struct expr stacklabel = { 0, "(STACK)" };
 static struct expr autolabel = { 0, "(AUTO)" };
 static struct expr retlabel = { 0, "(RETURN)" };
+static struct expr bodylabel = { 0, "(BODY)" };
+static struct expr funlabel = { 0, "(FUN)" };
 
 /*
  * Stack variables.
@@ -46,7 +55,7 @@ static struct expr retlabel = { 0, "(RETURN)" };
  * tos
  *     the last stack register pushed
  */
-static unsigned char stacksize;
+unsigned char stacksize;
 static signed char tos;
 
 /*
@@ -64,12 +73,187 @@ static signed char tos;
  * frametmpl
  *     frame register template
  */
-static unsigned char nparam, nauto, nframe;
+unsigned char nauto;
+static unsigned char nparam, nframe;
 static unsigned short frametmpl[NSCRATCH];
 
 /*
- * Allocate a frame register for expr and return it.  If expr is
- * of type RVALUE, LVALUE, RSTACK, or LSTACK,  return it unchanged.
+ * The pointer pool.  Constants, labels, and pointers into the data
+ * area are the same in every function.  Instead of templating them in
+ * the call frame of each function using them, those spilled by more
+ * than one function are spilled into pool registers allocated from
+ * the top of the zero page downwards and shared by all functions.  The
+ * pool is assembled right into the zero page, so it is never loaded,
+ * saved, or restored.  It only grows as long as it stays clear of the
+ * frames of all functions seen so far; beyond that, values are
+ * templated as usual.
+ *
+ * pool, npool
+ *     the values of the pool registers, starting with the topmost
+ *     scratch register
+ *
+ * spilled, nspilled
+ *     values templated by earlier functions and not pooled
+ */
+static unsigned short pool[MAXPOOL];
+static unsigned char npool = 0;
+static unsigned short spilled[SPILLSIZ];
+static unsigned short nspilled = 0;
+
+/*
+ * The pending call.  A function call is not emitted right away but
+ * remembered until the next instruction is emitted.  This gives ret()
+ * the chance to turn a call to the current function immediately
+ * followed by a return into a jump back to the function body.
+ *
+ * callee
+ *     the function to call
+ *
+ * callargs, ncallarg
+ *     the arguments of the call and their number.  If no call is
+ *     pending, ncallarg is -1.
+ */
+static struct expr callee, callargs[ARGSIZ];
+static signed char ncallarg = -1;
+
+/*
+ * The intermediate representation (see opt.h).
+ *
+ * infun
+ *     1 while the body of a function is compiled, 0 otherwise
+ */
+struct ins ir[IRSIZ];
+unsigned short nir;
+static unsigned char infun = 0;
+
+/*
+ * Inline expansion.  When a function ends, its instructions are
+ * examined.  If the body is short straight line code that neither
+ * calls other functions nor modifies or takes the address of its
+ * parameters or automatic variables, it is copied to the inline
+ * table.  Later calls to the function are replaced with these
+ * instructions, fed through isel once more.  Parameters are replaced
+ * with the arguments of the call while stack registers and automatic
+ * variables are moved to unused stack registers of the caller.
+ *
+ * inlines, ninline
+ *     the inline table containing the bodies of all functions that can
+ *     be expanded inline.
+ */
+enum { NOINLINE = 0377 };
+
+static struct ins inlines[INLSIZ];
+static unsigned short ninline = 0;
+
+/*
+ * Frame shapes.  Each function calls a prologue routine on entry and
+ * an epilogue routine on exit.  The generic ENTER and LEAVE routines
+ * in the runtime interprete the call frame with a loop for each part
+ * of it.  For the most frequently called frame shapes, i.e.
+ * combinations of the number of registers to save, arguments, and
+ * templates, emitstubs() generates specialised routines that perform
+ * the same work with unrolled code.  These are called through
+ * pointers in the topmost scratch registers not used by any function.
+ * As the epilogue only restores registers, shapes with the same number
+ * of registers to save share one epilogue.  The call frame itself is
+ * the same regardless of what routines are used.
+ *
+ * shapes, nshape
+ *     the frame shapes seen so far.  leave is a label for the word
+ *     calling the shape's epilogue.  ncall is the number of calls to
+ *     functions of this shape.  eslot and lslot are the registers
+ *     holding pointers to the specialised prologue and epilogue, or 0
+ *     if the shape is not specialised.  estub and lstub are the labels
+ *     of the specialised routines.
+ *
+ * funs, nfun
+ *     the functions called or defined so far.  For each function, its
+ *     label, the label for the word calling the prologue, its shape,
+ *     and the number of calls to it are remembered.  Functions not
+ *     defined in this program have shape NOSHAPE.  For functions that
+ *     can be expanded inline, the location and length of the body in
+ *     the inline table, the size of the call frame, and whether the
+ *     function stores to memory are remembered, too.  Otherwise, nbody
+ *     is NOINLINE.
+ *
+ * enterlabel
+ *     the label for the word calling the current function's prologue
+ *
+ * maxsave
+ *     the highest number of registers saved by any function
+ */
+enum { NOSHAPE = 0177777 };
+
+static struct shape {
+	unsigned char nsave, nparam, nframe;
+	unsigned char eslot, lslot;
+	unsigned short ncall;
+	struct expr leave, estub, lstub;
+} shapes[DEFNSIZ];
+
+static struct fun {
+	unsigned short label, shape, ncall, body;
+	unsigned char nbody, nparam, nstack, nauto, stores;
+	struct expr enter;
+} funs[DEFNSIZ];
+
+static unsigned short nshape = 0, nfun = 0;
+static unsigned char maxsave = 0;
+static struct expr enterlabel = { 0, "(ENTER)" };
+
+/* optimise for size instead of speed? */
+char optsize = 0;
+
+/* instruction timing in units of 100 ns */
+static const struct cpu cpus[] = {
+	/* PDP-8/E, PDP-8/F, PDP-8/M */
+	{ "8e", 12, 26, 12, 2, 26, 13 },
+
+	/* PDP-8/A with 1.5 us memory */
+	{ "8a", 15, 30, 15, 0, 30, 15 },
+};
+
+const struct cpu *cpu = cpus;
+
+/*
+ * Return the number of the pool register for v, or -1 if v is to be
+ * templated in the frame of the current function.  A new pool register
+ * is only allocated if v was templated by an earlier function and the
+ * register lies above the frames of all functions including the
+ * current one.  Otherwise, v is remembered as templated.
+ */
+static int
+pooled(int v)
+{
+	int i, r = NZEROPAGE - 1 - npool;
+
+	for (i = 0; i < npool; i++)
+		if (pool[i] == v)
+			return (i);
+
+	for (i = 0; i < nspilled; i++)
+		if (spilled[i] == v)
+			break;
+
+	if (i == nspilled) {
+		if (nspilled < SPILLSIZ)
+			spilled[nspilled++] = v;
+
+		return (-1);
+	}
+
+	if (npool >= MAXPOOL || r < MINSCRATCH + maxsave
+	    || r < MINSCRATCH + nframe + stacksize)
+		return (-1);
+
+	spilled[i] = spilled[--nspilled];
+	pool[npool] = v;
+	return (npool++);
+}
+
+/*
+ * Allocate a pool or frame register for expr and return it.  If expr
+ * is of type RVALUE, LVALUE, RSTACK, or LSTACK,  return it unchanged.
  * Otherwise the result always has type RVALUE or LVALUE.
  */
 static struct expr
@@ -104,10 +288,20 @@ spill(const struct expr *e)
 		if (frametmpl[i] == (v & ~LMASK))
 			goto found;
 
+	/* only pointers into the call frame differ between functions */
+	if (rclass(v) != RAUTO && rclass(v) != RPARAM) {
+		i = pooled(v & ~LMASK);
+		if (i >= 0) {
+			r.value = NZEROPAGE - 1 - i | RVALUE | v & LMASK;
+			return (r);
+		}
+	}
+
 	/* not found */
-	if (nframe >= NSCRATCH)
+	if (MINSCRATCH + nframe + stacksize >= NZEROPAGE - npool)
 		fatal(NULL, "frame overflow");
 
+	i = nframe;
 	frametmpl[nframe++] = v & ~LMASK;
 
 found:	r.value = MINSCRATCH + i | RVALUE | v & LMASK;
@@ -158,20 +352,48 @@ lstr(const struct expr *e)
 	return (buf);
 }
 
+/*
+ * Append instruction op with operand e to the intermediate
+ * representation.  e may be NULL for OPR instructions.
+ */
+static void
+irappend(int op, const struct expr *e)
+{
+	static const struct expr invalid = { INVALID, "" };
+
+	if (nir >= IRSIZ)
+		fatal(NULL, "function too long");
+
+	ir[nir].op = op;
+	ir[nir].e = e != NULL ? *e : invalid;
+	nir++;
+}
+
 extern void
 emitl(const struct expr *e)
 {
-	struct expr spill = { 0, "(SPILL)" };
+	struct expr lit = { 0, "(SPILL)" }, tmpl;
+
+	flushcall();
+	if (infun) {
+		irappend(WORD, e);
+		return;
+	}
 
 	switch (class(e->value)) {
 	/* spill needed to construct address */
 	case RCONST:
 	case RLABEL:
 	case RDATA:
+		literal(&lit, e);
+		e = &lit;
+		break;
+
+	/* only known in the current frame, so spill into the template */
 	case RAUTO:
 	case RPARAM:
-		literal(&spill, e);
-		e = &spill;
+		tmpl = spill(e);
+		e = &tmpl;
 		break;
 
 	/* no spill needed */
@@ -187,6 +409,8 @@ emitr(const struct expr *e)
 {
 	struct expr le;
 
+	flushcall();
+
 	switch (class(e->value)) {
 	case RCONST:
 	case RLABEL:
@@ -225,6 +449,83 @@ arg(const struct expr *e)
 	return (buf);
 }
 
+extern int
+setcpu(const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof cpus / sizeof cpus[0]; i++)
+		if (strcmp(cpus[i].name, name) == 0) {
+			cpu = cpus + i;
+			return (0);
+		}
+
+	return (-1);
+}
+
+extern struct cost
+isncost(int op, const struct expr *e)
+{
+	struct cost c = { 1, 0 };
+	int v, indirect = 0;
+
+	if ((op & 07000) == OPR) {
+		c.time = cpu->opr;
+		return (c);
+	}
+
+	/* operand fetch, mirroring spill() and arg() */
+	v = e->value;
+	switch (class(v)) {
+	case RVALUE:
+	case RSTACK:
+		break;
+
+	case LVALUE:
+		indirect = 1;
+		if (val(v) >= 010 && val(v) <= 017)
+			c.time = cpu->autoinc;
+		break;
+
+	case LSTACK:
+		indirect = 1;
+		break;
+
+	case LCONST:
+		if (val(v) < NZEROPAGE)
+			break;
+
+		/* FALLTHROUGH */
+
+	default:
+		c.words++;
+		indirect = islval(v);
+	}
+
+	if ((op & 07000) == JMP)
+		c.time += indirect ? cpu->jmpi : cpu->opr;
+	else
+		c.time += cpu->mri + (indirect ? cpu->defer : 0);
+
+	return (c);
+}
+
+extern void
+addcost(struct cost *c, struct cost d)
+{
+	c->words += d.words;
+	c->time += d.time;
+}
+
+extern int
+cheaper(struct cost a, struct cost b)
+{
+	if (optsize)
+		return (a.words < b.words || a.words == b.words && a.time < b.time);
+	else
+		return (a.time < b.time || a.time == b.time && a.words < b.words);
+}
+
 /*
  * Generate a group 1 microcoded instruction.  Up to four instructions
  * may be emitted:
@@ -372,10 +673,417 @@ emitpop(struct expr *e)
 	e->value = EXPIRED;
 }
 
+/*
+ * Find the entry for the function at label v in the function table.
+ * If there is none, create a new one.
+ */
+static struct fun *
+findfun(int v)
+{
+	int i;
+
+	for (i = 0; i < nfun; i++)
+		if (funs[i].label == v)
+			return (funs + i);
+
+	if (nfun >= DEFNSIZ)
+		fatal(NULL, "function table full");
+
+	funs[nfun].label = v;
+	funs[nfun].shape = NOSHAPE;
+	funs[nfun].ncall = 0;
+	funs[nfun].nbody = NOINLINE;
+
+	return (funs + nfun++);
+}
+
+/*
+ * Find the index of the frame shape for the current function with
+ * nsave registers to save and ntmpl template registers to load.  If
+ * there is none, create a new one.
+ */
+static int
+findshape(int nsave, int ntmpl)
+{
+	struct shape *s;
+	int i;
+
+	for (i = 0; i < nshape; i++) {
+		s = shapes + i;
+		if (s->nsave == nsave && s->nparam == nparam && s->nframe == ntmpl)
+			return (i);
+	}
+
+	if (nshape >= DEFNSIZ)
+		fatal(NULL, "shape table full");
+
+	s = shapes + nshape;
+	s->nsave = nsave;
+	s->nparam = nparam;
+	s->nframe = ntmpl;
+	s->eslot = 0;
+	s->lslot = 0;
+	s->ncall = 0;
+	newlabel(&s->leave);
+
+	return (nshape++);
+}
+
+/*
+ * Compute the size of the specialised prologue and epilogue routines
+ * for shape s.
+ */
+static int
+entersize(const struct shape *s)
+{
+	return (8 + 2 * s->nsave + 2 * s->nframe + (s->nparam > 0 ? 9 + 4 * s->nparam : 0));
+}
+
+static int
+leavesize(const struct shape *s)
+{
+	return (8 + (s->nsave > 0 ? 4 + 2 * s->nsave : 0));
+}
+
+/*
+ * If the current function can be expanded inline, copy its body into
+ * the inline table and remember it in f.  The body is the first basic
+ * block, which must either end with an unconditional jump to the
+ * function's epilogue or run into it.  The labels delimiting the body
+ * may have been deleted by the optimiser.
+ */
+static void
+keepinline(struct fun *f)
+{
+	int i, n, op, v, end, first, stores = 0;
+
+	/* skip over the body label */
+	first = nir > 0 && ir[0].op == LABEL;
+
+	end = blockend(first);
+	if (end > first && ir[end - 1].op == JMP) {
+		if (ir[end - 1].e.value != retlabel.value || end - 2 >= 0 && isskip(ir[end - 2].op))
+			return;
+
+		n = end - 1;
+	} else if (end == nir || ir[end].e.value == retlabel.value)
+		n = end;
+	else
+		return;
+
+	n -= first;
+	if (n > MAXINLINE || ninline + n > INLSIZ)
+		return;
+
+	for (i = first; i < first + n; i++) {
+		op = ir[i].op;
+		v = ir[i].e.value;
+
+		if (op == LABEL)
+			return;
+
+		if (op == RUNTIME || (op & 07000) == OPR)
+			continue;
+
+		switch (op & 07000) {
+		case JMS:
+			return;
+
+		case ISZ:
+		case DCA:
+			if (class(v) == LPARAM)
+				return;
+
+			if (class(v) != RSTACK && class(v) != LAUTO && class(v) != RVALUE)
+				stores = 1;
+
+			break;
+
+		default:
+			;
+		}
+
+		if (class(v) == RPARAM || class(v) == RAUTO)
+			return;
+	}
+
+	memcpy(inlines + ninline, ir + first, n * sizeof *ir);
+	f->body = ninline;
+	f->nbody = n;
+	f->nparam = nparam;
+	f->nstack = stacksize;
+	f->nauto = nauto;
+	f->stores = stores;
+	ninline += n;
+}
+
+/*
+ * Spill the operands of the instructions in the intermediate
+ * representation and print them.
+ */
+static void
+lower(void)
+{
+	struct ins *in;
+	int i;
+
+	for (i = 0; i < nir; i++) {
+		in = ir + i;
+		switch (in->op) {
+		case LABEL:
+			emitlabel(&in->e);
+			break;
+
+		case WORD:
+			emitl(&in->e);
+			break;
+
+		case RUNTIME:
+			emitrt(in->e.name);
+			break;
+
+		default:
+			emitisn(in->op, &in->e);
+		}
+	}
+}
+
+/*
+ * Compute the cost of calling function fun with argc arguments and the
+ * cost of expanding its body inline instead.  f is the entry for fun in
+ * the function table.  The prologue and epilogue
+ * are assumed to take as long as a memory reference instruction for
+ * each instruction of their specialised versions.
+ */
+static void
+callcost(struct cost *call, struct cost *body, const struct expr *fun,
+    const struct fun *f, int argc)
+{
+	struct cost rt; /* JMS I to the runtime */
+	const struct shape *s;
+	const struct ins *b;
+	int i;
+
+	rt.words = 1;
+	rt.time = cpu->mri + cpu->defer;
+	s = shapes + f->shape;
+	*call = isncost(JMS, fun);
+	call->words += argc;
+	call->time += cpu->mri * (entersize(s) + leavesize(s));
+
+	body->words = 0;
+	body->time = 0;
+	for (i = 0; i < f->nbody; i++) {
+		b = inlines + f->body + i;
+		addcost(body, b->op == RUNTIME ? rt : isncost(b->op, &b->e));
+	}
+
+	/* copying arguments */
+	if (f->stores) {
+		body->words += 2 * f->nparam;
+		body->time += 2 * cpu->mri * f->nparam;
+	}
+}
+
+/*
+ * Try to expand a call to fun with argc arguments args inline.  Return
+ * 1 on success, 0 if fun cannot be expanded inline or calling it is
+ * cheaper.
+ */
+static int
+expand(const struct expr *fun, const struct expr *args, int argc)
+{
+	struct fun *f;
+	struct ins *b;
+	struct cost call, body;
+	struct expr a[ARGSIZ], e;
+	int i, v, base, top;
+
+	if (class(fun->value) != LLABEL)
+		return (0);
+
+	f = findfun(fun->value);
+	if (f->nbody == NOINLINE || argc < f->nparam)
+		return (0);
+
+	callcost(&call, &body, fun, f, argc);
+	if (!cheaper(body, call))
+		return (0);
+
+	/* allocate stack registers for the callee's registers and copies */
+	base = tos + 1;
+	top = base + f->nstack + f->nauto;
+	for (i = 0; i < f->nparam; i++) {
+		a[i] = args[i];
+		if (f->stores && islval(a[i].value))
+			top++;
+	}
+
+	if (top > NSCRATCH)
+		return (0);
+
+	if (top > stacksize)
+		stacksize = top;
+
+	/* copy arguments the callee might overwrite */
+	top = base + f->nstack + f->nauto;
+	for (i = 0; i < f->nparam; i++)
+		if (f->stores && islval(a[i].value)) {
+			e = a[i];
+			memset(a[i].name, 0, MAXNAME);
+			a[i].value = RSTACK | top++;
+			lda(&e);
+			dca(a + i);
+		}
+
+	/* the callee expects AC to be clear on entry */
+	ldconst(0);
+
+	for (i = 0; i < f->nbody; i++) {
+		b = inlines + f->body + i;
+		e = b->e;
+		v = e.value;
+
+		switch (class(v)) {
+		case LPARAM:
+			e = a[val(v)];
+			break;
+
+		case RSTACK:
+		case LSTACK:
+			e.value = v + base;
+			break;
+
+		case LAUTO:
+			e.value = RSTACK | base + f->nstack + val(v);
+			break;
+
+		default:
+			;
+		}
+
+		if (b->op == RUNTIME) {
+			acrandom();
+			emitrt(e.name);
+		} else
+			isel(b->op, &e);
+	}
+
+	return (1);
+}
+
+extern void
+emitcall(const struct expr *fun, const struct expr *args, int argc)
+{
+	flushcall();
+
+	if (expand(fun, args, argc))
+		return;
+
+	acrandom();
+	callee = *fun;
+	memcpy(callargs, args, argc * sizeof *args);
+	ncallarg = argc;
+}
+
+extern void
+flushcall(void)
+{
+	int i, argc = ncallarg;
+
+	if (argc < 0)
+		return;
+
+	ncallarg = -1;
+	emitisn(JMS, &callee);
+	for (i = 0; i < argc; i++)
+		emitl(callargs + i);
+}
+
+extern void
+emitrt(const char *name)
+{
+	struct expr e = { RANDOM, "" };
+
+	flushcall();
+	if (infun) {
+		strncpy(e.name, name, MAXNAME - 1);
+		e.name[MAXNAME - 1] = '\0';
+		irappend(RUNTIME, &e);
+	} else
+		instr(NAMEFMT, name);
+}
+
+extern void
+emitlabel(const struct expr *e)
+{
+	if (infun)
+		irappend(LABEL, e);
+	else
+		label("L%04o,", val(e->value));
+}
+
+/*
+ * Turn the pending call, which must be a call to the current function,
+ * into a tail call:  store the arguments into the parameter area and
+ * jump to the beginning of the function body.  The parameters are
+ * stored from left to right, so arguments referring to parameters to
+ * the left of them are copied to stack registers first.  These are
+ * allocated above all registers holding arguments as those have
+ * already been popped.
+ */
+static void
+tailcall(void)
+{
+	struct expr par = { 0, "" }, *a;
+	int i, v, argc = ncallarg, top = tos + 1;
+
+	ncallarg = -1;
+	acrandom();
+
+	for (i = 0; i < argc; i++)
+		if (onstack(callargs[i].value) && val(callargs[i].value) >= top)
+			top = val(callargs[i].value) + 1;
+
+	for (i = 0; i < argc; i++) {
+		a = callargs + i;
+		v = a->value;
+		if (class(v) != LCONST && (class(v) != LPARAM || val(v) >= i))
+			continue;
+
+		par.value = RSTACK | top++;
+		if (top > stacksize) {
+			stacksize = top;
+			if (stacksize > NSCRATCH)
+				error(NULL, "stack overflow");
+		}
+
+		lda(a);
+		dca(&par);
+		*a = par;
+	}
+
+	for (i = 0; i < argc && i < nparam; i++) {
+		par.value = LPARAM | i;
+		if (callargs[i].value != par.value) {
+			lda(callargs + i);
+			dca(&par);
+		}
+	}
+
+	ldconst(0);
+	jmp(&bodylabel);
+}
+
 extern void
 ret(void)
 {
-	jmp(&retlabel);
+	/* return f(...) with f being the current function? */
+	if (ncallarg >= 0 && onstack(acstate.value)
+	    && class(callee.value) == LLABEL && callee.value == funlabel.value)
+		tailcall();
+	else
+		jmp(&retlabel);
 }
 
 extern void
@@ -386,6 +1094,8 @@ newframe(const struct expr *fun)
 	newlabel(&stacklabel);
 	newlabel(&autolabel);
 	newlabel(&retlabel);
+	newlabel(&bodylabel);
+	funlabel = *fun;
 
 	tos = -1;
 	stacksize = 0;
@@ -396,11 +1106,16 @@ newframe(const struct expr *fun)
 	cleardecl();
 
 	/* function prologue */
+	newlabel(&enterlabel);
 	emitc(0);
 	commentname(fun->name);
-	instr("ENTER");
+	emitl(&enterlabel);
 	emitl(&framelabel);
 
+	nir = 0;
+	infun = 1;
+	putlabel(&bodylabel);
+
 	acclear();
 }
 
@@ -419,11 +1134,36 @@ newauto(struct expr *var)
 extern void endframe(const struct expr *fun)
 {
 	struct expr dummy = { 0, "(dummy)" };
+	struct fun *f;
 	int i, nsave;
 
 	/* function epilogue */
 	putlabel(&retlabel);
-	instr("LEAVE");
+	infun = 0;
+
+	optimise();
+	if (ndead > 0)
+		comment("%04o DEAD WORDS REMOVED", ndead);
+
+	if (njump > 0)
+		comment("%04o JMPS REMOVED", njump);
+
+	f = findfun(fun->value);
+	keepinline(f);
+	preload();
+	lower();
+
+	nsave = nframe + stacksize;
+	if (MINSCRATCH + nsave > NZEROPAGE - npool)
+		fatal(NULL, "frame overflow");
+
+	if (nsave > maxsave)
+		maxsave = nsave;
+
+	f->enter = enterlabel;
+
+	f->shape = findshape(nsave, nframe + ninit);
+	emitl(&shapes[f->shape].leave);
 	emitl(fun);
 
 	blank();
@@ -435,7 +1175,6 @@ extern void endframe(const struct expr *fun)
 	putlabel(&framelabel);
 
 	/* saved registes area */
-	nsave = nframe + stacksize;
 	emitc(-nsave);
 	comment("SAVE %04o REGISTERS", nsave);
 	advance(nsave);
@@ -448,14 +1187,19 @@ extern void endframe(const struct expr *fun)
 		advance(nparam);
 	}
 
-	/* frame template */
-	emitc(-nframe);
-	comment("LOAD %04o TEMPLATES", nframe);
+	/* frame template, followed by the values of preloaded stack registers */
+	emitc(-nframe - ninit);
+	comment("LOAD %04o TEMPLATES", nframe + ninit);
 	for (i = 0; i < nframe; i++) {
 		dummy.value = frametmpl[i];
 		emitr(&dummy);
 	}
 
+	for (i = 0; i < ninit; i++) {
+		dummy.value = RCONST | stackinit[i];
+		emitr(&dummy);
+	}
+
 	/* automatic variable area */
 	if (nauto > 0) {
 		putlabel(&autolabel);
@@ -463,6 +1207,263 @@ extern void endframe(const struct expr *fun)
 	}
 }
 
+/*
+ * Emit the label of a specialised routine of the given size.  If the
+ * routine would cross a page boundary, advance to the next page first
+ * as the routine refers to its own return address.
+ */
+static void
+stublabel(const struct expr *e, int size)
+{
+	instr("IFNZRO .&0177+%04o-1&7600 <PAGE>", size);
+	putlabel(e);
+	emitc(0);
+}
+
+/*
+ * Emit a specialised prologue for shape s.  This does the same as the
+ * generic ENTER routine, but the loops are unrolled and the registers
+ * are saved and loaded with direct instead of indexed addressing.
+ */
+static void
+enterstub(const struct shape *s)
+{
+	const char *l;
+	int i;
+
+	stublabel(&s->estub, entersize(s));
+	comment("ENTER %04o %04o %04o", s->nsave, s->nparam, s->nframe);
+	l = lstr(&s->estub);
+	instr("CLA");
+	instr("TAD I %s", l);
+	comment("POINTER TO FRAME AREA");
+	instr("DCA 0010");
+
+	for (i = 0; i < s->nsave; i++) {
+		instr("TAD %04o", MINSCRATCH + i);
+		instr("DCA I 0010");
+		comment("SAVE REGISTER");
+	}
+
+	instr("ISZ 0010");
+	comment("SKIP ARGUMENT COUNT");
+
+	if (s->nparam > 0) {
+		instr("STA CLL RAL");
+		instr("TAD %s", l);
+		comment("POINTER TO CALLER'S RETURN ADDRESS");
+		instr("DCA TMP2");
+		instr("STA");
+		instr("TAD I TMP2");
+		instr("DCA 0011");
+		comment("BEFORE FUNCTION ARGUMENTS");
+
+		for (i = 0; i < s->nparam; i++) {
+			instr("TAD I 0011");
+			instr("DCA TMP3");
+			instr("TAD I TMP3");
+			instr("DCA I 0010");
+			comment("COPY ARGUMENT");
+		}
+
+		instr("IAC");
+		instr("TAD 0011");
+		instr("DCA I TMP2");
+		comment("SKIP OVER ARGUMENTS");
+	}
+
+	instr("ISZ 0010");
+	comment("SKIP TEMPLATE COUNT");
+
+	for (i = 0; i < s->nframe; i++) {
+		instr("TAD I 0010");
+		instr("DCA %04o", MINSCRATCH + i);
+		comment("LOAD TEMPLATE");
+	}
+
+	instr("ISZ %s", l);
+	instr("JMP I %s", l);
+	blank();
+}
+
+/*
+ * Emit a specialised epilogue for shape s.  Like LEAVE, this restores
+ * the saved registers and then returns from the function.
+ */
+static void
+leavestub(const struct shape *s)
+{
+	const char *l;
+	int i;
+
+	stublabel(&s->lstub, leavesize(s));
+	comment("LEAVE %04o", s->nsave);
+	l = lstr(&s->lstub);
+	instr("DCA TMP3");
+	comment("REMEMBER RETURN VALUE");
+	instr("TAD I %s", l);
+	instr("DCA %s", l);
+	instr("TAD I %s", l);
+	instr("DCA TMP2");
+	comment("RETURN ADDRESS");
+
+	if (s->nsave > 0) {
+		instr("ISZ %s", l);
+		instr("ISZ %s", l);
+		instr("TAD I %s", l);
+		instr("DCA 0010");
+		comment("POINTER TO FRAME AREA");
+
+		for (i = 0; i < s->nsave; i++) {
+			instr("TAD I 0010");
+			instr("DCA %04o", MINSCRATCH + i);
+			comment("RESTORE REGISTER");
+		}
+	}
+
+	instr("TAD TMP3");
+	instr("JMP I TMP2");
+	blank();
+}
+
+extern void
+emitstubs(void)
+{
+	struct shape *s, *best;
+	struct expr here = { 0, "(HERE)" };
+	int i, j, nstub, slot = NZEROPAGE - npool;
+
+	for (i = 0; i < nfun; i++)
+		if (funs[i].shape != NOSHAPE)
+			shapes[funs[i].shape].ncall += funs[i].ncall;
+
+	/* pick the most frequently called shapes, stubs only save time */
+	for (nstub = 0; !optsize && nstub < MAXSTUB; nstub++) {
+		best = NULL;
+		for (i = 0; i < nshape; i++) {
+			s = shapes + i;
+			if (s->eslot != 0 || s->ncall == 0)
+				continue;
+
+			if (entersize(s) > STUBSIZ || leavesize(s) > STUBSIZ)
+				continue;
+
+			if (best == NULL || s->ncall > best->ncall)
+				best = s;
+		}
+
+		if (best == NULL)
+			break;
+
+		/* share epilogues between shapes */
+		for (i = 0; i < nshape; i++)
+			if (shapes[i].lslot != 0 && shapes[i].nsave == best->nsave)
+				break;
+
+		if (slot - (i < nshape ? 1 : 2) < MINSCRATCH + maxsave)
+			break;
+
+		best->eslot = --slot;
+		newlabel(&best->estub);
+		if (i < nshape) {
+			best->lslot = shapes[i].lslot;
+			best->lstub = shapes[i].lstub;
+		} else {
+			best->lslot = --slot;
+			newlabel(&best->lstub);
+		}
+	}
+
+	/* words calling prologues and epilogues */
+	for (i = 0; i < nfun; i++) {
+		if (funs[i].shape == NOSHAPE)
+			continue;
+
+		s = shapes + funs[i].shape;
+		setlabel(&funs[i].enter);
+		if (s->eslot != 0)
+			instr("JMS I %04o", s->eslot);
+		else
+			instr("ENTER");
+	}
+
+	for (i = 0; i < nshape; i++) {
+		s = shapes + i;
+		setlabel(&s->leave);
+		if (s->lslot != 0)
+			instr("JMS I %04o", s->lslot);
+		else
+			instr("LEAVE");
+	}
+
+	blank();
+
+	if (nstub == 0)
+		return;
+
+	/* pointers to the specialised routines */
+	newlabel(&here);
+	setlabel(&here);
+	instr(".");
+	instr("*%04o", slot);
+	for (i = slot; i < NZEROPAGE; i++)
+		for (j = 0; j < nshape; j++) {
+			s = shapes + j;
+			if (s->eslot == i) {
+				emitl(&s->estub);
+				comment("ENTER %04o %04o %04o", s->nsave, s->nparam, s->nframe);
+				break;
+			} else if (s->lslot == i) {
+				emitl(&s->lstub);
+				comment("LEAVE %04o", s->nsave);
+				break;
+			}
+		}
+
+	instr("*%s", lstr(&here));
+	blank();
+
+	/* the routines themselves */
+	for (i = 0; i < nshape; i++) {
+		s = shapes + i;
+		if (s->eslot == 0)
+			continue;
+
+		enterstub(s);
+
+		/* only emit shared epilogues once */
+		for (j = 0; j < i; j++)
+			if (shapes[j].lslot == s->lslot)
+				break;
+
+		if (j == i)
+			leavestub(s);
+	}
+}
+
+extern void
+emitpool(void)
+{
+	struct expr here = { 0, "(HERE)" }, e = { 0, "" };
+	int i;
+
+	if (npool == 0)
+		return;
+
+	newlabel(&here);
+	setlabel(&here);
+	instr(".");
+	instr("*%04o", NZEROPAGE - npool);
+	comment("POINTER POOL");
+	for (i = npool - 1; i >= 0; i--) {
+		e.value = pool[i];
+		emitr(&e);
+	}
+
+	instr("*%s", lstr(&here));
+	blank();
+}
+
 extern void
 emitisn(int isn, const struct expr *e)
 {
@@ -470,6 +1471,12 @@ emitisn(int isn, const struct expr *e)
 	int skp = 0;
 	char buf[5];
 
+	flushcall();
+	if (infun) {
+		irappend(isn, e);
+		return;
+	}
+
 	switch (isn & 07000) {
 	case IOT:
 		sprintf(buf, "%04o", isn & 07777);
@@ -485,6 +1492,10 @@ emitisn(int isn, const struct expr *e)
 		/* FALLTHROUGH */
 
 	default:
+		/* remember call counts for emitstubs() */
+		if ((isn & 07000) == JMS && class(e->value) == LLABEL)
+			findfun(e->value)->ncall++;
+
 		instr("%s %s", mnemo[isn >> 9 & 7], arg(e));
 		commentname(e->name);
 		if (skp)
@@ -22,17 +22,32 @@
  *     forget any knowledge about what AC contains
  *     and assume that its contents are unpredictable.  This is used
  *     whenever isel is circumvented such that AC may have been
- *     modified.
+ *     modified.  As this happens for calls, what is known about
+ *     memory other than stack registers is forgotten, too.
  *
  * lany()
  *     tell isel() that we don't care about what value the L register
  *     has, permitting isel() to set it to an arbitrary value.
+ *
+ * joinjump(e)
+ *     record the machine state for a jump to label e.  This is done
+ *     by isel() for each JMP instruction and must be done by the
+ *     caller for jumps isel() does not see, e.g. through jump tables.
+ *
+ * joinlabel(v, fwd)
+ *     update the machine state for placing label v.  If fwd is set,
+ *     all jumps to v precede it and the machine state is what these
+ *     jumps and the code falling through to v have in common.  AC is
+ *     then unpredictable if it is not known.  Otherwise, L, AC, and
+ *     memory are forgotten as control may reach v from anywhere.
  */
 extern void isel(int, const struct expr *);
 extern void undefer(void);
 extern void iselrst(void);
 extern void iselacrnd(void);
 extern void lany(void);
+extern void joinjump(const struct expr *);
+extern void joinlabel(int, int);
 
 /*
  * Emit the PDP-8 instruction isn.  Unless isn is an OPR instruction,
@@ -41,6 +56,80 @@ extern void lany(void);
  */
 extern void emitisn(int, const struct expr *);
 
+/*
+ * Cost model.  The cost of a code sequence is the number of words it
+ * occupies and the time it takes to execute in units of 100 ns as given
+ * by the timing table of the selected CPU model.  Where different code
+ * sequences can be generated for the same construct, the cheapest one
+ * is chosen.  By default, the execution time is minimised and the
+ * number of words only breaks ties.  If optsize is set, it is the other
+ * way round.
+ *
+ * struct cpu
+ *     Instruction timing of a CPU model: the time of an OPR or direct
+ *     JMP instruction, a memory reference instruction with a direct
+ *     operand, the extra time for an indirect operand and for
+ *     incrementing an auto-index register, an indirect JMP, and a
+ *     single memory cycle.
+ *
+ * cpu
+ *     The CPU model code is optimised for.  Defaults to the PDP-8/E.
+ *
+ * setcpu(name)
+ *     Select the CPU model called name.  Return 0 on success, -1 if
+ *     there is no such model.
+ *
+ * isncost(op, e)
+ *     Return the cost of instruction op with operand e.  If e needs to
+ *     be spilled, the word for the frame template register is included.
+ *
+ * addcost(c, d)
+ *     Add cost d to c.
+ *
+ * cheaper(a, b)
+ *     Return 1 if a is cheaper than b, 0 otherwise.
+ */
+struct cpu {
+	const char *name;
+	unsigned char opr, mri, defer, autoinc, jmpi, cycle;
+};
+
+struct cost {
+	unsigned short words;
+	long time;
+};
+
+extern char optsize;
+extern const struct cpu *cpu;
+extern int setcpu(const char *);
+extern struct cost isncost(int, const struct expr *);
+extern void addcost(struct cost *, struct cost);
+extern int cheaper(struct cost, struct cost);
+
+/*
+ * Function calls.
+ *
+ * emitcall(fun, args, argc)
+ *     Emit a call to function fun with the argc arguments in args.  The
+ *     return value is in AC afterwards.  If fun is a small function
+ *     defined earlier and expanding its body inline is cheaper than
+ *     calling it, the body is expanded inline.  Otherwise, the
+ *     call is only emitted once the next instruction is emitted, so
+ *     ret() can turn it into a tail call.
+ *
+ * flushcall()
+ *     Emit the pending call, if any.  This is done automatically
+ *     whenever an instruction or a word is emitted through isel or
+ *     codegen.
+ *
+ * emitrt(name)
+ *     Emit a call to the runtime routine name, e.g. MUL.  As the
+ *     routine modifies L:AC, acrandom() must be called first.
+ */
+extern void emitcall(const struct expr *, const struct expr *, int);
+extern void flushcall(void);
+extern void emitrt(const char *);
+
 /*
  * Emitting literal values.
  *
@@ -51,13 +140,21 @@ extern void emitisn(int, const struct expr *);
  * emitl(expr)
  *     Emits the address of expr into the instruction stream.  expr can
  *     be of type LCONST, RVALUE, LLABEL, LDATA, RSTACK, LAUTO, or
- *     LPARAM.  Additionally, if expr is of type RCONST, RLABEL, RDATA,
- *     RAUTO, or RPARAM, it is spilled to the data area and the offset
- *     into the data area is printed.
+ *     LPARAM.  Additionally, if expr is of type RCONST, RLABEL, or
+ *     RDATA, it is spilled to the data area and the offset into the
+ *     data area is printed.  If it is of type RAUTO or RPARAM, it is
+ *     spilled to the frame template of the current function and the
+ *     address of the template register is printed.
  */
 extern void emitr(const struct expr *);
 extern void emitl(const struct expr *);
 
+/*
+ * Place label e at the current location.  Use putlabel() instead of
+ * calling this directly.
+ */
+extern void emitlabel(const struct expr *);
+
 /*
  * Call frame management.
  *
@@ -88,7 +185,10 @@ extern void emitl(const struct expr *);
  *
  * ret()
  *     Generate code to return from the current function.  The return
- *     value is whatever is currently in AC.
+ *     value is whatever is currently in AC.  If the return value is the
+ *     result of a pending call to the current function, the call is
+ *     turned into a jump to the beginning of the function body with
+ *     the parameters set to the arguments of the call instead.
  *
  * endframe(expr)
  *     End the current call frame and emit the required data.  expr must
@@ -100,8 +200,18 @@ extern void emitl(const struct expr *);
  *         number of arguments, negated
  *         argument storage area
  *         number of template registers to load, negated
- *         frame template
+ *         frame template, including preloaded stack registers
  *         automatic variable area
+ *
+ * emitstubs()
+ *     Emit the words calling each function's prologue and epilogue.
+ *     For the most frequently called frame shapes, specialised
+ *     prologue and epilogue routines are emitted, too.  This must be
+ *     called once at the end of the program.
+ *
+ * emitpool()
+ *     Emit the pointer pool into the zero page.  This must be called
+ *     once at the end of the program.
  */
 extern void emitpush(struct expr *);
 extern void emitpop(struct expr *);
@@ -110,3 +220,5 @@ extern void newparam(struct expr *);
 extern void newauto(struct expr *);
 extern void ret(void);
 extern void endframe(const struct expr *);
+extern void emitstubs(void);
+extern void emitpool(void);
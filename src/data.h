@@ -16,7 +16,7 @@
  *     find and occurence of c in the data area and make expr->value
  *     point to it.  If such an occurence does not exist, append c to
  *     the data area to create one.  c should be of type RCONST, RLABEL,
- *     RDATA, RAUTO, or RPARAM.
+ *     or RDATA.
  *
  * dumpdata()
  *     dump the content of the data area into the assembly output.
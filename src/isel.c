@@ -57,11 +57,326 @@ enum {
 
 static unsigned char skipstate = NORMAL;
 
+/*
+ * Memory cells known to hold a constant.  When a constant is stored to
+ * a memory location accessed directly, this is remembered so loads
+ * from it can be computed like loads of the constant itself.  Stores
+ * through pointers or to absolute addresses and calls forget all cells
+ * but stack registers as stack registers cannot be referred to
+ * otherwise.  At labels, only the cells known on all paths to the
+ * label are kept.
+ *
+ * cells, ncell
+ *     the cells known and the values they hold
+ */
+enum { MAXCELL = 16 };
+static struct cell {
+	unsigned short value, c;
+} cells[MAXCELL];
+static unsigned char ncell = 0;
+
+/*
+ * The memory location last stored to with DCA and the expressions
+ * whose value was in AC at that time.  Loading from copyto again
+ * makes them aliases of AC.  copyto is INVALID if there is no such
+ * location.
+ */
+static unsigned short copyto = INVALID, copies[MAXALIAS + 1];
+static unsigned char ncopy = 0;
+
+/*
+ * Machine states at labels.  For each jump to a label not placed yet,
+ * the machine state at the jump is recorded.  At a label only jumped
+ * to from code before it, the machine state is what the jumps to it
+ * and the code falling through to it have in common.  At other labels,
+ * L and memory are unknown and AC is set up by the parser.
+ *
+ * joins, njoin
+ *     the states recorded for labels not placed yet.  If a state could
+ *     not be recorded for lack of space, overflow is set.
+ *
+ * placed
+ *     a bitmap of the labels placed so far.  Jumps to these are not
+ *     recorded.
+ *
+ * reachable
+ *     0 after an unconditional jump, i.e. if the current location can
+ *     only be reached by jumping to a label.
+ */
+enum { MAXJOIN = 32 };
+static struct join {
+	unsigned short label;
+	unsigned char ncell;
+	struct ac ac;
+	struct cell cells[MAXCELL];
+} joins[MAXJOIN];
+static unsigned char placed[010000 / 8];
+static unsigned char njoin = 0, overflow = 0, reachable = 1;
+
 /* acstate templates */
 static const struct expr zero = { RCONST | 0, "" };
 static const struct expr random = { RANDOM, "" };
 static const struct expr invalid = { INVALID, "" };
 
+/*
+ * Return 1 if memory location v is accessed directly and known by name.
+ */
+static int
+isnamed(int v)
+{
+	switch (class(v)) {
+	case RSTACK:
+	case LLABEL:
+	case LDATA:
+	case LAUTO:
+	case LPARAM:
+		return (1);
+
+	default:
+		return (0);
+	}
+}
+
+/*
+ * Return 1 if the value of expression a may change when memory
+ * location v is modified.  v is RANDOM if the location is not known.
+ * Stack registers are only modified by name.
+ */
+static int
+depends(int a, int v)
+{
+	switch (class(a)) {
+	case RCONST:
+	case RLABEL:
+	case RDATA:
+	case RAUTO:
+	case RPARAM:
+		return (0);
+
+	case RSTACK:
+		return (a == v);
+
+	case LLABEL:
+	case LDATA:
+	case LAUTO:
+	case LPARAM:
+		return (a == v || !isnamed(v));
+
+	default:
+		return (1);
+	}
+}
+
+/*
+ * Set acstate to e and forget its aliases.
+ */
+static void
+setac(const struct expr *e)
+{
+	acstate = *e;
+	nalias = 0;
+}
+
+/*
+ * Forget the aliases of AC and the copies that may change when memory
+ * location v is modified.
+ */
+static void
+killalias(int v)
+{
+	int i, k;
+
+	for (i = k = 0; i < nalias; i++)
+		if (!depends(aliases[i], v))
+			aliases[k++] = aliases[i];
+
+	nalias = k;
+	if (depends(acstate.value, v)) {
+		if (nalias > 0) {
+			acstate.value = aliases[--nalias];
+			memset(acstate.name, 0, MAXNAME);
+		} else
+			acstate = random;
+	}
+
+	if (depends(copyto, v)) {
+		copyto = INVALID;
+		ncopy = 0;
+	}
+
+	for (i = k = 0; i < ncopy; i++)
+		if (!depends(copies[i], v))
+			copies[k++] = copies[i];
+
+	ncopy = k;
+}
+
+/*
+ * Remember that memory location v was just set to what is in AC.
+ */
+static void
+copyac(int v)
+{
+	int i;
+
+	copyto = v;
+	ncopy = 0;
+	if (acstate.value != RANDOM)
+		copies[ncopy++] = acstate.value;
+
+	for (i = 0; i < nalias; i++)
+		copies[ncopy++] = aliases[i];
+}
+
+/*
+ * Note that AC was just loaded from v.  If v holds a copy of other
+ * expressions, these are in AC, too.
+ */
+static void
+loaded(int v)
+{
+	int i;
+
+	addalias(v);
+	if (v == copyto)
+		for (i = 0; i < ncopy; i++)
+			addalias(copies[i]);
+}
+
+/*
+ * Return the cell for memory location v or NULL if its content is not
+ * known.
+ */
+static struct cell *
+findcell(int v)
+{
+	int i;
+
+	for (i = 0; i < ncell; i++)
+		if (cells[i].value == v)
+			return (cells + i);
+
+	return (NULL);
+}
+
+/*
+ * Forget the content of all cells.  If keepstack is set, stack
+ * registers are kept.
+ */
+static void
+forgetcells(int keepstack)
+{
+	int i, j;
+
+	for (i = j = 0; i < ncell; i++)
+		if (keepstack && class(cells[i].value) == RSTACK)
+			cells[j++] = cells[i];
+
+	ncell = j;
+
+	/* copies are memory contents, too */
+	if (keepstack)
+		killalias(RANDOM);
+	else {
+		copyto = INVALID;
+		ncopy = 0;
+	}
+}
+
+/*
+ * Record a store to memory location v.  If known is set, constant c is
+ * stored, otherwise the content of v is unknown afterwards.
+ */
+static void
+store(int v, int known, int c)
+{
+	struct cell *cl;
+
+	killalias(v);
+	if (!isnamed(v)) {
+		forgetcells(1);
+		return;
+	}
+
+	cl = findcell(v);
+	if (cl != NULL)
+		*cl = cells[--ncell];
+
+	if (known && ncell < MAXCELL) {
+		cells[ncell].value = v;
+		cells[ncell].c = c;
+		ncell++;
+	}
+}
+
+/*
+ * Return the state recorded for label v or NULL if there is none.
+ */
+static struct join *
+findjoin(int v)
+{
+	int i;
+
+	for (i = 0; i < njoin; i++)
+		if (joins[i].label == val(v))
+			return (joins + i);
+
+	return (NULL);
+}
+
+/*
+ * Reduce the state recorded in j to what it has in common with the
+ * current state.
+ */
+static void
+meet(struct join *j)
+{
+	struct cell *cl;
+	int i, k;
+
+	if (~want.known & ACKNOWN || (want.lac ^ j->ac.lac) & 07777)
+		j->ac.known &= ~ACKNOWN;
+
+	if (~want.known & LKNOWN || (want.lac ^ j->ac.lac) & 010000)
+		j->ac.known &= ~LKNOWN;
+
+	for (i = k = 0; i < j->ncell; i++) {
+		cl = findcell(j->cells[i].value);
+		if (cl != NULL && cl->c == j->cells[i].c)
+			j->cells[k++] = j->cells[i];
+	}
+
+	j->ncell = k;
+}
+
+extern void
+joinjump(const struct expr *e)
+{
+	struct join *j;
+
+	/* only reachable direct jumps to labels not placed yet count */
+	if (!reachable || class(e->value) != LLABEL
+	    || placed[val(e->value) >> 3] & 1 << (val(e->value) & 7))
+		return;
+
+	j = findjoin(e->value);
+	if (j != NULL) {
+		meet(j);
+		return;
+	}
+
+	if (njoin >= MAXJOIN) {
+		overflow = 1;
+		return;
+	}
+
+	j = joins + njoin++;
+	j->label = val(e->value);
+	j->ac = want;
+	j->ncell = ncell;
+	memcpy(j->cells, cells, ncell * sizeof *cells);
+}
+
 /*
  * Peel instructions off op until NOP remains.  The instructions are
  * returned in the following order:
@@ -93,11 +408,44 @@ peelopr(int *op)
 	return (NOP);
 }
 
+/*
+ * If a skip on L followed by (CLA) IAC has been deferred to compute a
+ * truth value, replace it by a single instruction rotating L or its
+ * complement into the cleared AC.  This leaves L clear.
+ */
+static void
+glk(void)
+{
+	struct instr *d = deferred + ndefer - 2;
+
+	if (ndefer < 2 || (d->op & ~00170) != (OPR2 | CLA) || (d[1].op & ~00200) != IAC)
+		return;
+
+	switch (d->op & 00170) {
+	case SNL & 00170:
+		d->op = GLK | CML;
+		break;
+
+	case SZL & 00170:
+		d->op = GLK;
+		break;
+
+	default:
+		return;
+	}
+
+	ndefer--;
+}
+
 extern void
 undefer(void)
 {
 	int i;
 
+	if (skipstate == SKIPFWD)
+		glk();
+
+	flushcall();
 	for (i = 0; i < ndefer; i++)
 		emitisn(deferred[i].op, &deferred[i].e);
 
@@ -164,8 +512,8 @@ static const unsigned short seq2preservel[][3] = {
 	02000, CLA | RTL,		STL | RTR,
 	03777, STA | RAL,		CLL | RAR,
 	04000, CLA | RAL,		STL | RAR,
+	05777, STA | RTL,		CLL | RTR,
 	06000, CLA | RTL,		STL | IAC | RTR,
-	06777, STA | RTL,		CLL | RTR,
 	07775, STA | RTR,		CLL | RTL,
 	07776, STA | RAR,		CLL | RAL,
 	00000, 0,			0,
@@ -175,31 +523,64 @@ static const unsigned short dummyseq[1][3] = { 0, 0, 0 };
 #define seq2clearl dummyseq
 #define seq2setl dummyseq
 
+/*
+ * A way for fold to set up L:AC: the n instructions in op, the last of
+ * which may take operand k, leaving L:AC in state ac at cost c.
+ */
+struct way {
+	unsigned short op[2];
+	unsigned char n;
+	struct expr k;
+	struct ac ac;
+	struct cost c;
+};
+
+/*
+ * Replace best with w if w is cheaper.  Ties go to the way considered
+ * first.
+ */
+static void
+consider(struct way *best, struct way *w)
+{
+	int i;
+
+	w->c.words = 0;
+	w->c.time = 0;
+	for (i = 0; i < w->n; i++)
+		addcost(&w->c, isncost(w->op[i], &w->k));
+
+	if (best->n == 0 || cheaper(w->c, best->c))
+		*best = *w;
+}
+
 /*
  * Find a sequence of up to 2 OPR instructions that produce lac
- * in L:AC.  If such a sequence is found, defer it and return 1.
- * Otherwise, return 0.
+ * in L:AC.  If such a sequence is found, consider it as a way
+ * leaving L:AC in state ac.
  */
-static int
-findseq(const unsigned short seq[][3], int lac)
+static void
+findseq(struct way *best, const unsigned short seq[][3], int lac,
+    struct ac ac)
 {
+	struct way w;
 	int i;
 
 	for (i = 0; seq[i][1] != 0; i++)
 		if (seq[i][0] == lac) {
-			defer(seq[i][1], NULL);
-			if (seq[i][2] != 0)
-				defer(seq[i][2], NULL);
-
-			return (1);
+			w.op[0] = seq[i][1];
+			w.op[1] = seq[i][2];
+			w.n = seq[i][2] != 0 ? 2 : 1;
+			w.k = invalid;
+			w.ac = ac;
+			consider(best, &w);
+			return;
 		}
-
-	return (0);
 }
 
 /*
  * Assuming what the deferred instructions do is just computing
  * constants, fold the computations into at most 2 instructions.
+ * Each applicable strategy is costed and the cheapest one is used.
  *
  * invariant: if ACKNOWN or LKNOWN are set in have, they are also
  * set in want.
@@ -208,7 +589,9 @@ static void
 fold(void)
 {
 	int wantac, haveac, acknown, preservel = 0, flipl = 0, clearl = 0, setl = 0;
-	struct expr e = { 0, "" };
+	struct way best, w;
+	struct ac clear, set;
+	int i;
 
 	/* discard deferred instructions */
 	ndefer = 0;
@@ -247,70 +630,71 @@ fold(void)
 		return;
 	}
 
-	/* strategy 1--3: 1 instruction OPR sequences */
-	if (clearl && findseq(seq1clearl, wantac)) {
-		want.known |= LKNOWN;
-		want.lac &= ~010000;
-		return;
-	}
+	clear.known = want.known | LKNOWN;
+	clear.lac = wantac;
+	set.known = want.known | LKNOWN;
+	set.lac = wantac | 010000;
+	best.n = 0;
 
-	if (setl && findseq(seq1setl, wantac)) {
-		want.known |= LKNOWN;
-		want.lac |= 010000;
-		return;
-	}
+	/* strategy 1--6: OPR sequences */
+	if (clearl)
+		findseq(&best, seq1clearl, wantac, clear);
 
-	if (!setl && !clearl && preservel && findseq(seq1preservel, wantac))
-		return;
+	if (setl)
+		findseq(&best, seq1setl, wantac, set);
 
-	/* strategy 4--6: 2 instruction OPR sequences */
-	if (clearl && findseq(seq2clearl, wantac)) {
-		want.known |= LKNOWN;
-		want.lac &= ~010000;
-		return;
-	}
+	if (preservel)
+		findseq(&best, seq1preservel, wantac, want);
 
-	if (setl && findseq(seq2setl, wantac)) {
-		want.known |= LKNOWN;
-		want.lac |= 010000;
-		return;
-	}
+	if (clearl)
+		findseq(&best, seq2clearl, wantac, clear);
 
-	if (!setl && !clearl && preservel && findseq(seq2preservel, wantac))
-		return;
+	if (setl)
+		findseq(&best, seq2setl, wantac, set);
+
+	if (preservel)
+		findseq(&best, seq2preservel, wantac, want);
 
 	/* strategy 7--9: 1 instruction TAD/AND sequences */
+	w.n = 1;
+	w.op[0] = TAD;
+	w.k = invalid;
+	w.k.value = RCONST | wantac - haveac & 07777;
+	w.ac = want;
 	if (acknown && preservel && haveac <= wantac) {
-		e.value = RCONST | wantac - haveac;
-		defer(TAD, &e);
-		want.lac = wantac | have.lac & 010000;
-		return;
+		w.ac.lac = wantac | have.lac & 010000;
+		consider(&best, &w);
 	}
 
 	if (acknown && flipl && haveac > wantac) {
-		e.value = RCONST | wantac - haveac;
-		defer(TAD, &e);
-		want.lac = wantac | ~have.lac & 010000;
-		return;
+		w.ac.lac = wantac | ~have.lac & 010000;
+		consider(&best, &w);
 	}
 
+	w.op[0] = AND;
+	w.k.value = RCONST | wantac;
 	if (acknown && preservel && (~haveac & wantac) == 0) {
-		e.value = RCONST | wantac;
-		defer(AND, &e);
-		want.lac = wantac | have.lac & 010000;
-		return;
+		w.ac.lac = wantac | have.lac & 010000;
+		consider(&best, &w);
 	}
 
 	/* strategy 10: just do whatever is needed */
+	w.n = 2;
 	if (clearl)
-		defer(CLA | CLL, NULL);
+		w.op[0] = CLA | CLL;
 	else if (setl)
-		defer(CLA | STL, NULL);
+		w.op[0] = CLA | STL;
 	else /* preservel */
-		defer(CLA, NULL);
+		w.op[0] = CLA;
+
+	w.op[1] = TAD;
+	w.ac = want;
+	consider(&best, &w);
 
-	e.value = RCONST | wantac;
-	defer(TAD, &e);
+	for (i = 0; i < best.n; i++)
+		defer(best.op[i], (best.op[i] & 07000) == OPR ? NULL : &best.k);
+
+	want = best.ac;
 }
 
 /*
@@ -326,10 +710,25 @@ normalsel(int op, const struct expr *e)
 	 * must_emit & 2, we also need to set acstate to random.
 	 */
 	int must_emit = 0;
-	int v;
+	int v, load;
+	struct expr k = { 0, "" };
+	struct cell *cl;
 
 	v = e != NULL ? e->value : INVALID;
 
+	/* loading v into a clear AC makes it an alias of AC */
+	if (op == TAD && want.known & ACKNOWN && (want.lac & 07777) == 0)
+		load = v;
+	else
+		load = INVALID;
+
+	/* load from a cell known to hold a constant? */
+	if ((op == TAD || op == AND) && (cl = findcell(v)) != NULL) {
+		k.value = RCONST | cl->c;
+		e = &k;
+		v = k.value;
+	}
+
 	switch (op & 07000) {
 	case AND:
 		if (want.known & ACKNOWN && isconst(v))
@@ -357,7 +756,7 @@ normalsel(int op, const struct expr *e)
 			} else if ((want.lac & 007777) == 0) {
 				want.known &= ~ACKNOWN;
 				must_emit |= 1;
-				acstate = *e;
+				setac(e);
 				break;
 			}
 		}
@@ -371,20 +770,21 @@ normalsel(int op, const struct expr *e)
 	case ISZ:
 		skipstate = SKIPABLE;
 		must_emit |= 1;
-
-		if (inac(e->value))
-			must_emit |= 2;
-
+		store(v, 0, 0);
 		break;
 
 	case DCA:
 		must_emit |= 1;
+		store(v, want.known & ACKNOWN, want.lac & 07777);
+		copyac(v);
 		want.lac &= 010000;
 		want.known |= ACKNOWN;
 		break;
 
 	case JMP:
 		must_emit |= 1;
+		joinjump(e);
+		reachable = 0;
 		break;
 
 	case OPR: {
@@ -560,11 +960,17 @@ normalsel(int op, const struct expr *e)
 	} else
 		defer(op, e);
 
+	/* aliases stay valid as long as the content of AC does */
 	if (want.known & ACKNOWN) {
-		acstate = zero;
-		acstate.value = RCONST | want.lac & 007777;
+		if (acstate.value != (RCONST | want.lac & 007777)) {
+			k.value = RCONST | want.lac & 007777;
+			setac(&k);
+		}
 	} else if (must_emit & 2)
-		acstate = random;
+		setac(&random);
+
+	if (load != INVALID)
+		loaded(load);
 }
 
 /*
@@ -584,7 +990,7 @@ skipsel(int op, const struct expr *e)
 	 */
 	if ((op & ~00200) == IAC && (ac_is_clear || op & 00200)) {
 		skipstate = SKIPFWD;
-		acstate = random;
+		setac(&random);
 		want.known = 0;
 		defer(op, e);
 		return;
@@ -600,15 +1006,18 @@ skipsel(int op, const struct expr *e)
 
 	case ISZ:
 		skipstate = SKIPABLE;
+		store(e->value, 0, 0);
 		break;
 
 	case DCA:
 		if (!ac_is_clear)
 			affects_lac = 1;
 
+		store(e->value, 0, 0);
 		break;
 
 	case JMP:
+		joinjump(e);
 		break;
 
 	case OPR:
@@ -662,7 +1071,7 @@ skipsel(int op, const struct expr *e)
 	}
 
 	if (affects_lac) {
-		acstate = random;
+		setac(&random);
 		want.known = 0;
 	}
 
@@ -673,20 +1082,27 @@ skipsel(int op, const struct expr *e)
 extern void
 iselrst(void)
 {
-	acstate = zero;
+	setac(&zero);
 	ndefer = 0;
 	want.lac = 0;
 	want.known = LANY | ACKNOWN;
 	have = want;
 	skipstate = NORMAL;
+	ncell = 0;
+	copyto = INVALID;
+	ncopy = 0;
+	njoin = 0;
+	overflow = 0;
+	reachable = 1;
 }
 
 extern void
 iselacrnd(void)
 {
-	acstate = random;
+	setac(&random);
 	want.known = LANY;
 	undefer();
+	forgetcells(1);
 }
 
 extern void
@@ -697,15 +1113,82 @@ lany(void)
 		fold();
 }
 
+extern void
+joinlabel(int v, int fwd)
+{
+	struct expr k = { 0, "" };
+	struct join tmp, *j;
+
+	placed[val(v) >> 3] |= 1 << (val(v) & 7);
+	j = findjoin(v);
+	if (j != NULL) {
+		tmp = *j;
+		*j = joins[--njoin];
+		j = &tmp;
+	}
+
+	/* labels jumped to from anywhere */
+	if (!fwd) {
+		undefer();
+		want.known = LANY;
+		have = want;
+		forgetcells(0);
+		setac(&random);
+		reachable = 1;
+		return;
+	}
+
+	if (j == NULL && (overflow || !reachable)) {
+		/* jumps not recorded or no way to reach the label */
+		want.known = LANY;
+		ncell = 0;
+	} else if (j != NULL) {
+		/*
+		 * if all jumps to v have AC clear, clear AC on the way in
+		 * so AC is known at v; clearing it after v would cost
+		 * the jumps an instruction.
+		 */
+		if (reachable && j->ac.known & ACKNOWN && (j->ac.lac & 07777) == 0
+		    && (~want.known & ACKNOWN || want.lac & 07777)) {
+			isel(CLA, NULL);
+			undefer();
+		}
+
+		if (reachable)
+			meet(j);
+
+		want = j->ac;
+		want.known |= LANY;
+		ncell = j->ncell;
+		memcpy(cells, j->cells, ncell * sizeof *cells);
+	} else
+		want.known |= LANY;
+
+	have = want;
+	reachable = 1;
+	copyto = INVALID;
+	ncopy = 0;
+	if (want.known & ACKNOWN) {
+		k.value = RCONST | want.lac & 07777;
+		setac(&k);
+	} else
+		setac(&random);
+}
+
 extern void
 isel(int op, const struct expr *e)
 {
 	switch (skipstate) {
 	case DOSKIP:
-		/* discard skip and current instruction if possible */
+		/*
+		 * discard skip and current instruction if possible.  As
+		 * the skip may have cleared AC, too, the deferred
+		 * instructions are computed anew.
+		 */
 		if (ndefer != 0) {
 			ndefer--;
 			skipstate = NORMAL;
+			fold();
 			break;
 		}
 
@@ -749,17 +1232,21 @@ isel(int op, const struct expr *e)
 		}
 
 		/* record effect of CLA */
-		acstate = zero;
+		setac(&zero);
 		want.known |= ACKNOWN;
 		want.lac &= ~07777;
 
 		/* discard (CLA) IAC and current skip */
 		ndefer--;
+
+		/* the next instruction is subject to the skip */
+		skipstate = SKIPABLE;
 		break;
 
 		/* can't forward conditional */
 	normal:
 		skipstate = NORMAL;
+		glk();
 		/* FALLTHROUGH */
 
 	case NORMAL:
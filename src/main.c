@@ -3,6 +3,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #include "param.h"
 #include "pdp8.h"
@@ -32,20 +33,40 @@ const char ident[] =
  * TODO: only do the mapping if the symbol was not redefined by the
  * program.
  */
-enum { NSTDLIB = 4 };
-static const char stdlib[NSTDLIB][8] = {
+const char stdlib[NSTDLIB][MAXNAME] = {
 	"EXIT", "GETCHAR", "PUTCHAR", "SENSE",
 };
 
 extern int
-main(void)
+main(int argc, char *argv[])
 {
 	size_t i;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "m:s")) != -1)
+		switch (opt) {
+		case 'm':
+			if (setcpu(optarg) == 0)
+				break;
+
+			fprintf(stderr, "%s: unknown CPU model %s\n", argv[0], optarg);
+			return (EXIT_FAILURE);
+
+		case 's':
+			optsize = 1;
+			break;
+
+		default:
+			fprintf(stderr, "Usage: %s [-s] [-m model]\n", argv[0]);
+			return (EXIT_FAILURE);
+		}
 
 	asmfile = stdout;
 
 	yyparse();
 	dumpdata();
+	emitstubs();
+	emitpool();
 
 	/* tell the B runtime where MAIN is */
 	label("MAIN=");
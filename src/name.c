@@ -9,6 +9,7 @@
 #include "error.h"
 #include "param.h"
 #include "pdp8.h"
+#include "codegen.h"
 #include "name.h"
 
 /* definition and declaration tables */
@@ -94,7 +95,22 @@ extern void
 putlabel(const struct expr *e)
 {
 	catchup();
-	placelabel(e, ',');
+	if (rclass(e->value) != RLABEL)
+		fatal(e->name, "not a label");
+
+	joinlabel(e->value, 0);
+	emitlabel(e);
+}
+
+extern void
+putfwdlabel(const struct expr *e)
+{
+	catchup();
+	if (rclass(e->value) != RLABEL)
+		fatal(e->name, "not a label");
+
+	joinlabel(e->value, 1);
+	emitlabel(e);
 }
 
 extern void
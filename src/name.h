@@ -29,13 +29,24 @@ extern struct expr *lookup(const char name[MAXNAME]);
 extern struct expr *declare(struct expr *);
 extern void cleardecl(void);
 
+/*
+ * The names of the functions in the B runtime.  These only use the
+ * auto-index registers 0010 and 0011.
+ */
+enum { NSTDLIB = 4 };
+extern const char stdlib[NSTDLIB][MAXNAME];
+
 /*
  * Label generation machinery.  All labels generated by the compiler
  * have the form L#### where #### are four octal digits.  A new label
  * is generated with the newlabel function.  A label can be placed at
- * the current location with putlabel.  setlabel behaves similar but
- * sets the label's value to be whatever is emitted next.
+ * the current location with putlabel.  putfwdlabel does the same for
+ * labels all jumps to which have already been emitted, keeping what
+ * is known about the machine state on all paths to the label.
+ * setlabel behaves similar but sets the label's value to be whatever
+ * is emitted next.
  */
 extern void newlabel(struct expr *);
 extern void putlabel(const struct expr *);
+extern void putfwdlabel(const struct expr *);
 extern void setlabel(const struct expr *);
@@ -0,0 +1,3391 @@
+/*- (c) 2019 Robert Clausecker <fuz@fuz.su> */
+/* opt.c -- optimisation passes */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "param.h"
+#include "pdp8.h"
+#include "codegen.h"
+#include "error.h"
+#include "name.h"
+#include "opt.h"
+
+/*
+ * An instruction deleted by an optimisation pass.  Deleted
+ * instructions are removed by compact() once the pass is done.
+ */
+enum { DELETED = 040000 };
+
+/*
+ * Sets of stack registers.
+ */
+enum { SETSIZ = (NSCRATCH + 7) / 8 };
+
+struct regset {
+	unsigned char bits[SETSIZ];
+};
+
+#define inset(s, r) ((s)->bits[(r) >> 3] >> ((r) & 7) & 1)
+#define addset(s, r) ((s)->bits[(r) >> 3] |= 1 << ((r) & 7))
+#define delset(s, r) ((s)->bits[(r) >> 3] &= ~(1 << ((r) & 7)))
+
+/*
+ * The control flow graph of the current function.  Each basic block
+ * has up to two successors: the block it jumps to and the block it
+ * falls through to.  If a block jumps to a location not in the current
+ * function, e.g. through a pointer, anywhere is set instead.  For each
+ * block, the stack registers live on entry and exit are remembered as
+ * well as whether AC is known to be clear on entry (acz) and on exit
+ * (aczout).  Blocks between the target of a backwards jump and the
+ * jump are marked as being part of a loop.
+ *
+ * blocks, nblock
+ *     the basic blocks of the current function
+ */
+enum { NOBLOCK = -1 };
+
+static struct block {
+	unsigned short begin, end;
+	short jump, next;
+	unsigned char anywhere, acz, aczout, loop;
+	struct regset in, out;
+} blocks[IRSIZ];
+
+static unsigned short nblock;
+
+extern int
+isskip(int op)
+{
+	if (op & ~07777)
+		return (0);
+
+	return ((op & 07000) == ISZ || (op & OPR2) == OPR2 && op & 00170);
+}
+
+extern int
+blockend(int i)
+{
+	int j;
+
+	for (j = i; j < nir; j++) {
+		if (j > i && ir[j].op == LABEL)
+			break;
+
+		if ((ir[j].op & ~07777) == 0 && (ir[j].op & 07000) == JMP)
+			return (j + 1);
+	}
+
+	return (j);
+}
+
+/*
+ * Return 1 if the instruction at index i is only executed
+ * conditionally as it follows a skip instruction.
+ */
+static int
+iscond(int i)
+{
+	return (i > 0 && isskip(ir[i - 1].op));
+}
+
+/*
+ * Remove all deleted instructions from the intermediate
+ * representation.
+ */
+static void
+compact(void)
+{
+	int i, j;
+
+	for (i = j = 0; i < nir; i++)
+		if (ir[i].op != DELETED)
+			ir[j++] = ir[i];
+
+	nir = j;
+}
+
+/*
+ * Return the stack register referred to by e or -1 if e does not
+ * refer to a stack register.
+ */
+static int
+stackreg(const struct expr *e)
+{
+	return (onstack(e->value) ? val(e->value) : -1);
+}
+
+/*
+ * Return the stack register written to by instruction in, or -1 if
+ * none.  For ISZ, the register is read, too.
+ */
+static int
+defreg(const struct ins *in)
+{
+	if (in->op != DCA && in->op != ISZ || class(in->e.value) != RSTACK)
+		return (-1);
+
+	return (val(in->e.value));
+}
+
+/*
+ * Return the stack register read by instruction in, or -1 if none.
+ */
+static int
+usereg(const struct ins *in)
+{
+	if (in->op == LABEL || in->op == RUNTIME || in->op == DELETED)
+		return (-1);
+
+	if (in->op == DCA && class(in->e.value) == RSTACK)
+		return (-1);
+
+	if ((in->op & ~07777) == 0 && (in->op & 07000) == OPR)
+		return (-1);
+
+	return (stackreg(&in->e));
+}
+
+/*
+ * Find the block beginning with label v.  Return NOBLOCK if there is
+ * none.
+ */
+static int
+findlabel(int v)
+{
+	int i;
+
+	for (i = 0; i < nblock; i++)
+		if (ir[blocks[i].begin].op == LABEL && ir[blocks[i].begin].e.value == v)
+			return (i);
+
+	return (NOBLOCK);
+}
+
+/*
+ * Divide the intermediate representation into basic blocks and find
+ * the successors of each block.
+ */
+static void
+findblocks(void)
+{
+	struct block *b;
+	struct ins *last;
+	int i, j;
+
+	nblock = 0;
+	for (i = 0; i < nir; i = blocks[nblock++].end) {
+		blocks[nblock].begin = i;
+		blocks[nblock].end = blockend(i);
+	}
+
+	for (i = 0; i < nblock; i++) {
+		b = blocks + i;
+		last = ir + b->end - 1;
+		b->jump = NOBLOCK;
+		b->next = i + 1 < nblock ? i + 1 : NOBLOCK;
+		b->anywhere = 0;
+		b->loop = 0;
+
+		if (last->op != JMP)
+			continue;
+
+		if (class(last->e.value) == LLABEL)
+			b->jump = findlabel(last->e.value);
+
+		if (b->jump == NOBLOCK)
+			b->anywhere = 1;
+
+		if (!iscond(b->end - 1))
+			b->next = NOBLOCK;
+	}
+
+	for (i = 0; i < nblock; i++)
+		if (blocks[i].jump != NOBLOCK && blocks[i].jump <= i)
+			for (j = blocks[i].jump; j <= i; j++)
+				blocks[j].loop = 1;
+}
+
+/*
+ * Return whether AC is clear after executing instruction i given
+ * whether it is clear before (acz).
+ */
+static int
+clearsac(int i, int acz)
+{
+	int op = ir[i].op;
+
+	switch (op & ~07777 ? -1 : op & 07000) {
+	case AND:
+	case ISZ:
+	case JMP:
+		return (acz);
+
+	case DCA:
+		return (1);
+
+	case OPR:
+		if (op & CLA & 00377 && ((op & OPR2) == OPR2 || (op & 00057) == 0))
+			return (1);
+
+		/* only L and skips affected? */
+		if ((op & OPR2) == OPR2 || (op & 00057) == 0)
+			return (acz);
+
+		return (0);
+
+	case -1:
+		return (op == LABEL || op == WORD ? acz : 0);
+
+	default:
+		/* TAD, JMS */
+		return (0);
+	}
+}
+
+/*
+ * Return whether AC is clear before instruction i of block b.
+ */
+static int
+aczat(const struct block *b, int i)
+{
+	int j, acz = b->acz;
+
+	for (j = b->begin; j < i; j++) {
+		/* a conditional instruction may not execute */
+		if (iscond(j))
+			acz &= clearsac(j, acz);
+		else
+			acz = clearsac(j, acz);
+	}
+
+	return (acz);
+}
+
+/*
+ * Find out for each block whether AC is clear when it is entered.
+ * This is the case at the beginning of the function and if AC is
+ * clear at the end of each predecessor.  As the code generator makes
+ * sure AC is clear whenever a jump to a label is made through a
+ * pointer, the same goes for blocks only reached from anywhere.
+ */
+static void
+aczero(void)
+{
+	struct block *b;
+	int i, j, acz, changed, anyacz = 1;
+
+	for (i = 0; i < nblock; i++) {
+		blocks[i].acz = 1;
+		blocks[i].aczout = 1;
+	}
+
+	do {
+		changed = 0;
+		for (i = 0; i < nblock; i++) {
+			b = blocks + i;
+			acz = aczat(b, b->end);
+			if (acz != b->aczout) {
+				b->aczout = acz;
+				changed = 1;
+			}
+
+			if (b->anywhere && !acz)
+				anyacz = 0;
+		}
+
+		for (i = 1; i < nblock; i++) {
+			b = blocks + i;
+			acz = ir[b->begin].op != LABEL || anyacz;
+			for (j = 0; j < nblock; j++) {
+				if (blocks[j].next == i || blocks[j].jump == i)
+					acz &= blocks[j].aczout;
+			}
+
+			if (acz != b->acz) {
+				b->acz = acz;
+				changed = 1;
+			}
+		}
+	} while (changed);
+}
+
+/*
+ * Compute the stack registers live before instruction i of block b,
+ * given the registers live after the block in live.
+ */
+static void
+livebefore(struct regset *live, const struct block *b, int i)
+{
+	int j, r;
+
+	for (j = b->end - 1; j >= i; j--) {
+		r = defreg(ir + j);
+		if (r >= 0 && ir[j].op == DCA && !iscond(j))
+			delset(live, r);
+
+		r = usereg(ir + j);
+		if (r >= 0)
+			addset(live, r);
+	}
+}
+
+/*
+ * Compute the stack registers live on entry and exit of each block.
+ */
+static void
+liveness(void)
+{
+	struct block *b;
+	struct regset live;
+	int i, j, changed;
+
+	for (i = 0; i < nblock; i++) {
+		memset(&blocks[i].in, 0, sizeof blocks[i].in);
+		memset(&blocks[i].out, 0, sizeof blocks[i].out);
+	}
+
+	do {
+		changed = 0;
+		for (i = nblock - 1; i >= 0; i--) {
+			b = blocks + i;
+			if (b->anywhere)
+				memset(&live, 0377, sizeof live);
+			else
+				memset(&live, 0, sizeof live);
+
+			for (j = 0; j < SETSIZ; j++) {
+				if (b->jump != NOBLOCK)
+					live.bits[j] |= blocks[b->jump].in.bits[j];
+
+				if (b->next != NOBLOCK)
+					live.bits[j] |= blocks[b->next].in.bits[j];
+			}
+
+			b->out = live;
+			livebefore(&live, b, b->begin);
+			if (memcmp(&live, &b->in, sizeof live) != 0) {
+				b->in = live;
+				changed = 1;
+			}
+		}
+	} while (changed);
+}
+
+/*
+ * Local value numbering.  Within each basic block, the value of AC and
+ * of each memory location is described by a value number.  Two equal
+ * value numbers denote equal values.  Value numbers are indices into a
+ * table of nodes.  A node is either a constant, an unknown value, the
+ * content of a memory location pointed to by some value, or the
+ * result of applying an operation to other values.  Nodes are unique,
+ * so equal computations yield the same value number.
+ *
+ * Value numbers of memory contents are tracked for stack registers in
+ * stackvn and for other locations accessed directly in locs.  Stores
+ * to memory other than stack registers may modify any memory reached
+ * through a pointer, so memver counts such stores.
+ *
+ * A chain is a sequence of instructions without side effects that
+ * computes a value into AC starting from AC being clear.  If a chain
+ * is followed by a DCA or a skip on AC, and the value it computes is
+ * already held in a stack register or a memory location, the chain is
+ * replaced by loading that location if that is cheaper.  If it is
+ * about to be deposited where it already is, the chain and the DCA
+ * are deleted.  If a stack register held the value earlier in the
+ * block but was reused for other values since, these other values
+ * are moved to free stack registers so the value is kept.
+ */
+enum {
+	NOVN = 0,	/* no value number */
+	MAXVN = 01000,	/* maximum number of nodes per block */
+	MAXLOC = 00100,	/* maximum number of memory locations tracked */
+	MAXHIST = 00100, /* maximum number of chains remembered */
+	MAXMOVE = 00010, /* maximum number of values moved per chain */
+};
+
+enum { NCONST, NLEAF, NLOAD, NOPR, NTAD, NAND };
+
+static struct vnode {
+	unsigned char kind;
+	unsigned short a, b;
+} vnodes[MAXVN];
+
+static struct loc {
+	struct expr e;
+	unsigned short vn;
+} locs[MAXLOC];
+
+/*
+ * hist, nhist
+ *     the chains deposited into stack registers in the current block
+ *     and the values they computed
+ */
+static struct hist {
+	unsigned short at, vn;
+	unsigned char reg;
+} hist[MAXHIST];
+
+static unsigned short nvnode, nleaf, memver, stackvn[NSCRATCH];
+static unsigned char nloc, nhist;
+
+/*
+ * Find or make the node kind(a, b) and return its value number.  If
+ * the node table is full, return NOVN.
+ */
+static int
+vn(int kind, int a, int b)
+{
+	int i, t;
+
+	if (kind >= NLOAD && a == NOVN || kind >= NTAD && b == NOVN)
+		return (NOVN);
+
+	/* canonicalise operands of commutative operations */
+	if ((kind == NTAD || kind == NAND) && a > b) {
+		t = a;
+		a = b;
+		b = t;
+	}
+
+	for (i = 0; i < nvnode; i++)
+		if (vnodes[i].kind == kind && vnodes[i].a == a && vnodes[i].b == b)
+			return (i + 1);
+
+	if (nvnode >= MAXVN)
+		return (NOVN);
+
+	vnodes[nvnode].kind = kind;
+	vnodes[nvnode].a = a;
+	vnodes[nvnode].b = b;
+
+	return (++nvnode);
+}
+
+/*
+ * Return a value number for a new unknown value.
+ */
+static int
+leaf(void)
+{
+	return (vn(NLEAF, nleaf++, 0));
+}
+
+/*
+ * Return 1 if e is a memory location accessed directly, i.e. not
+ * through a pointer computed at runtime.
+ */
+static int
+isdirect(const struct expr *e)
+{
+	switch (class(e->value)) {
+	case LCONST:
+	case RVALUE:
+	case LLABEL:
+	case LDATA:
+	case LAUTO:
+	case LPARAM:
+		return (1);
+
+	default:
+		return (0);
+	}
+}
+
+/*
+ * Return 1 if e is a location not known by name, i.e. an absolute
+ * address which may alias anything.
+ */
+static int
+isabsolute(const struct expr *e)
+{
+	return (class(e->value) == LCONST || class(e->value) == RVALUE);
+}
+
+/*
+ * Return the value number of the content of directly accessed memory
+ * location e.
+ */
+static int
+locvn(const struct expr *e)
+{
+	int i, v;
+
+	for (i = 0; i < nloc; i++)
+		if (locs[i].e.value == e->value)
+			return (locs[i].vn);
+
+	v = leaf();
+	if (nloc < MAXLOC) {
+		locs[nloc].e = *e;
+		locs[nloc].vn = v;
+		nloc++;
+	}
+
+	return (v);
+}
+
+/*
+ * Return the value number of the content of stack register r.
+ */
+static int
+regvn(int r)
+{
+	if (stackvn[r] == NOVN)
+		stackvn[r] = leaf();
+
+	return (stackvn[r]);
+}
+
+/*
+ * Return the value number of operand e of a TAD or AND instruction.
+ */
+static int
+opvn(const struct expr *e)
+{
+	struct expr p;
+	int v = e->value;
+
+	switch (class(v)) {
+	case RCONST:
+	case RLABEL:
+	case RDATA:
+	case RAUTO:
+	case RPARAM:
+		return (vn(NCONST, v, 0));
+
+	case RSTACK:
+		return (regvn(val(v)));
+
+	case LSTACK:
+		return (vn(NLOAD, regvn(val(v)), memver));
+
+	case LVALUE:
+		p = l2rval(e);
+		return (vn(NLOAD, locvn(&p), memver));
+
+	default:
+		if (isdirect(e))
+			return (locvn(e));
+		else
+			return (leaf());
+	}
+}
+
+/*
+ * Forget everything known about memory other than stack registers.
+ */
+static void
+killmem(void)
+{
+	nloc = 0;
+	memver++;
+}
+
+/*
+ * Record that value number v was stored to e.
+ */
+static void
+store(const struct expr *e, int v)
+{
+	int i, j;
+
+	if (class(e->value) == RSTACK) {
+		stackvn[val(e->value)] = v;
+		return;
+	}
+
+	if (!isdirect(e) || isabsolute(e)) {
+		killmem();
+		if (!isdirect(e))
+			return;
+	}
+
+	memver++;
+	for (i = j = 0; i < nloc; i++)
+		if (locs[i].e.value != e->value && !isabsolute(&locs[i].e))
+			locs[j++] = locs[i];
+
+	nloc = j;
+	if (nloc < MAXLOC) {
+		locs[nloc].e = *e;
+		locs[nloc].vn = v;
+		nloc++;
+	}
+}
+
+/*
+ * Return 1 if the instruction at index i can be part of a chain.
+ * Apart from TAD and AND, only OPR instructions that neither clear AC
+ * nor depend on or leave a particular value in L are permitted, so
+ * removing a chain does not change anything L is needed for.
+ */
+static int
+inchain(int i)
+{
+	int op = ir[i].op;
+
+	switch (op & ~07777 ? -1 : op & 07000) {
+	case TAD:
+	case AND:
+		return (!iscond(i));
+
+	case OPR:
+		if (iscond(i) || op & (OPR2 & ~OPR) || op & (CLA | CML) & 00377)
+			return (0);
+
+		return (op & (RAR | RAL) & 00377 ? (op & CLL & 00377) != 0 : (op & CLL & 00377) == 0);
+
+	default:
+		return (0);
+	}
+}
+
+/*
+ * Return the cost of the instructions from index i to j.
+ */
+static struct cost
+rangecost(int i, int j)
+{
+	struct cost c = { 0, 0 };
+
+	for (; i < j; i++)
+		addcost(&c, isncost(ir[i].op, &ir[i].e));
+
+	return (c);
+}
+
+/*
+ * Return 1 if stack register r is referred to by any instruction from
+ * index i to j.
+ */
+static int
+refers(int r, int i, int j)
+{
+	for (; i < j; i++)
+		if (stackreg(&ir[i].e) == r)
+			return (1);
+
+	return (0);
+}
+
+/*
+ * Replace stack register r with stack register s in all instructions
+ * from index i to j.
+ */
+static void
+renamereg(int r, int s, int i, int j)
+{
+	for (; i < j; i++)
+		if (stackreg(&ir[i].e) == r)
+			ir[i].e.value = ir[i].e.value & ~07777 | s;
+}
+
+/*
+ * Find a stack register that is free from index i to j in block b,
+ * not counting r.  If there is none, return stacksize.
+ */
+static int
+freereg(const struct block *b, int r, int i, int j)
+{
+	struct regset live;
+	int s;
+
+	live = b->out;
+	livebefore(&live, b, j);
+
+	for (s = 0; s < stacksize; s++)
+		if (s != r && !inset(&live, s) && !refers(s, i, j))
+			return (s);
+
+	return (stacksize);
+}
+
+/*
+ * Stack register r held value number v after index at, but was reused
+ * for other values up to index i of block b.  Try to move those to
+ * other stack registers such that r still holds v at index i.  Return
+ * 1 on success, 0 otherwise.  If grow is not NULL, nothing is changed
+ * but *grow is set to whether a new stack register would be needed.
+ */
+static int
+keepvalue(const struct block *b, int r, int at, int i, int *grow)
+{
+	struct regset live;
+	int j, k, end, s, n = 0, d;
+
+	if (grow != NULL)
+		*grow = 0;
+
+	for (j = at + 1; j < i; j = end) {
+		/* find the next value deposited into r */
+		for (k = j; k < i; k++) {
+			d = defreg(ir + k);
+			if (d != r)
+				continue;
+
+			if (ir[k].op != DCA || iscond(k))
+				return (0);
+
+			break;
+		}
+
+		if (k == i)
+			return (1);
+
+		/* find its last use */
+		for (end = k + 1; end < b->end; end++)
+			if (defreg(ir + end) == r && ir[end].op == DCA && !iscond(end))
+				break;
+
+		if (end == b->end) {
+			live = b->out;
+			if (inset(&live, r))
+				return (0);
+		}
+
+		if (++n > MAXMOVE)
+			return (0);
+
+		s = freereg(b, r, k, end);
+		if (s >= NSCRATCH / 2)
+			return (0);
+
+		if (grow != NULL) {
+			if (s == stacksize)
+				*grow = 1;
+
+			continue;
+		}
+
+		if (s == stacksize)
+			stacksize++;
+
+		renamereg(r, s, k, end);
+		for (d = 0; d < nhist; d++)
+			if (hist[d].reg == r && hist[d].at >= k && hist[d].at < end)
+				hist[d].reg = s;
+
+		if (end >= i && stackvn[r] != NOVN)
+			stackvn[s] = stackvn[r];
+	}
+
+	return (1);
+}
+
+/*
+ * Value number the instructions of block b and eliminate redundant
+ * chains.
+ */
+static void
+lvn(const struct block *b)
+{
+	/*
+	 * saving and restoring a new stack register on each call, which
+	 * is only worth it if the block is executed repeatedly
+	 */
+	struct cost grown = { 1, 10 }, loopgrown = { 1, 1 };
+	struct expr holder, use;
+	struct cost c, best;
+	int i, j, op, r, ac, start = -1, found, grow;
+
+	grown.time *= cpu->cycle;
+	loopgrown.time *= cpu->cycle;
+	nvnode = 0;
+	nleaf = 0;
+	nloc = 0;
+	nhist = 0;
+	memver = 0;
+	memset(stackvn, 0, sizeof stackvn);
+	if (b->acz) {
+		ac = vn(NCONST, RCONST | 0, 0);
+		start = b->begin;
+	} else
+		ac = leaf();
+
+	for (i = b->begin; i < b->end; i++) {
+		op = ir[i].op;
+		if (op == LABEL) {
+			if (start == i)
+				start++;
+
+			continue;
+		}
+
+		/* end of a chain? */
+		if (start >= 0 && start < i && !iscond(i) && ac != NOVN
+		    && vnodes[ac - 1].kind != NCONST
+		    && (op == DCA || (op & OPR2) == OPR2 && !(op & SNL & 00377))) {
+			/* value already where it's going? */
+			if (op == DCA && (class(ir[i].e.value) == RSTACK ?
+			    stackvn[val(ir[i].e.value)] == ac :
+			    isdirect(&ir[i].e) && locvn(&ir[i].e) == ac)) {
+				for (j = start; j <= i; j++)
+					ir[j].op = DELETED;
+
+				start = i + 1;
+				ac = vn(NCONST, RCONST | 0, 0);
+				continue;
+			}
+
+			/* value held elsewhere? */
+			c = rangecost(start, i);
+			found = 0;
+			for (r = 0; r < NSCRATCH; r++)
+				if (stackvn[r] == ac) {
+					holder.value = RSTACK | r;
+					memset(holder.name, 0, MAXNAME);
+					if (!found || cheaper(isncost(TAD, &holder), best)) {
+						best = isncost(TAD, &holder);
+						use = holder;
+						found = 1;
+					}
+				}
+
+			for (j = 0; j < nloc; j++)
+				if (locs[j].vn == ac && (!found || cheaper(isncost(TAD, &locs[j].e), best))) {
+					best = isncost(TAD, &locs[j].e);
+					use = locs[j].e;
+					found = 1;
+				}
+
+			/* value held by a stack register reused since? */
+			for (j = nhist - 1; !found && j >= 0; j--) {
+				if (hist[j].vn != ac)
+					continue;
+
+				r = hist[j].reg;
+				if (!keepvalue(b, r, hist[j].at, start, &grow))
+					break;
+
+				holder.value = RSTACK | r;
+				memset(holder.name, 0, MAXNAME);
+				best = isncost(TAD, &holder);
+				if (grow)
+					addcost(&best, b->loop ? loopgrown : grown);
+
+				if (!cheaper(best, c))
+					break;
+
+				keepvalue(b, r, hist[j].at, start, NULL);
+				use = holder;
+				stackvn[r] = ac;
+				best = isncost(TAD, &holder);
+				found = 1;
+			}
+
+			if (found && cheaper(best, c)) {
+				ir[start].op = TAD;
+				ir[start].e = use;
+				for (j = start + 1; j < i; j++)
+					ir[j].op = DELETED;
+			}
+		}
+
+		switch (op & ~07777 ? -1 : op & 07000) {
+		case TAD:
+		case AND:
+			if (iscond(i))
+				ac = leaf();
+			else if (op == TAD && ac == vn(NCONST, RCONST | 0, 0))
+				ac = opvn(&ir[i].e);
+			else
+				ac = vn(op == TAD ? NTAD : NAND, ac, opvn(&ir[i].e));
+
+			break;
+
+		case DCA:
+			if (iscond(i)) {
+				store(&ir[i].e, leaf());
+				ac = leaf();
+				break;
+			}
+
+			r = stackreg(&ir[i].e);
+			if (class(ir[i].e.value) == RSTACK && nhist < MAXHIST && start >= 0) {
+				hist[nhist].at = i;
+				hist[nhist].reg = r;
+				hist[nhist].vn = ac;
+				nhist++;
+			}
+
+			store(&ir[i].e, ac);
+			ac = vn(NCONST, RCONST | 0, 0);
+			start = i + 1;
+			continue;
+
+		case ISZ:
+			store(&ir[i].e, leaf());
+			break;
+
+		case OPR:
+			if (iscond(i))
+				ac = leaf();
+			else if ((op & OPR2) == OPR2) {
+				if (op & CLA & 00377)
+					ac = vn(NCONST, RCONST | 0, 0);
+			} else {
+				if (op & CLA & 00377)
+					ac = vn(NCONST, RCONST | 0, 0);
+
+				/* group 1 with only CLA, CLL, and CML? */
+				if ((op & 00057) == 0) {
+					if (op & CLA & 00377 && !iscond(i)) {
+						start = i + 1;
+						continue;
+					}
+
+					break;
+				}
+
+				if (op & (RAR | RAL) & 00377 && (op & STL & 00377) != (CLL & 00377))
+					ac = leaf();
+				else
+					ac = vn(NOPR, ac, op & 00157);
+			}
+
+			if (inchain(i))
+				continue;
+
+			break;
+
+		default:
+			/* JMS, JMP, RUNTIME, and WORD */
+			if (op != WORD) {
+				killmem();
+				ac = leaf();
+			}
+		}
+
+		if (!inchain(i))
+			start = -1;
+	}
+}
+
+/*
+ * Eliminate common subexpressions in each basic block.
+ */
+static void
+cse(void)
+{
+	int i;
+
+	for (i = 0; i < nblock; i++)
+		lvn(blocks + i);
+
+	compact();
+}
+
+/*
+ * Dead code elimination.  Blocks not reachable from the beginning of
+ * the function are deleted.  A block whose label is used other than as
+ * the target of a jump, e.g. as the value of a label in a computed
+ * goto, is considered reachable.  Stores to stack registers that are
+ * not live and stores to automatic variables that are overwritten
+ * before being read are deleted, too, along with the chain computing
+ * the value stored.  A store to a stack register immediately reloaded
+ * into AC is deleted together with the load if the register is dead
+ * afterwards.  Only automatic variables whose address is never
+ * taken are considered as other variables may be read through
+ * pointers.  ndead counts the words removed.
+ */
+unsigned short ndead;
+
+/*
+ * Delete instruction i, counting the word removed.
+ */
+static void
+kill(int i)
+{
+	if (ir[i].op != LABEL)
+		ndead++;
+
+	ir[i].op = DELETED;
+}
+
+/*
+ * Delete all blocks not reachable from the beginning of the function.
+ */
+static void
+unreachable(void)
+{
+	static unsigned char reached[IRSIZ];
+	static short work[IRSIZ];
+	const struct block *b;
+	int i, n = 0, v;
+
+	memset(reached, 0, nblock);
+	reached[0] = 1;
+	work[n++] = 0;
+
+	/* labels used as values */
+	for (i = 0; i < nir; i++) {
+		if (ir[i].op == LABEL || ir[i].op == JMP || ir[i].op == RUNTIME)
+			continue;
+
+		v = ir[i].e.value;
+		if (rclass(v) != RLABEL)
+			continue;
+
+		v = findlabel(LLABEL | val(v));
+		if (v != NOBLOCK && !reached[v]) {
+			reached[v] = 1;
+			work[n++] = v;
+		}
+	}
+
+	while (n > 0) {
+		b = blocks + work[--n];
+		if (b->jump != NOBLOCK && !reached[b->jump]) {
+			reached[b->jump] = 1;
+			work[n++] = b->jump;
+		}
+
+		if (b->next != NOBLOCK && !reached[b->next]) {
+			reached[b->next] = 1;
+			work[n++] = b->next;
+		}
+	}
+
+	for (i = 0; i < nblock; i++)
+		if (!reached[i])
+			for (v = blocks[i].begin; v < blocks[i].end; v++)
+				kill(v);
+
+	compact();
+}
+
+/*
+ * Return 1 if the address of automatic variable or parameter v is
+ * taken anywhere in the current function.
+ */
+static int
+escapes(int v)
+{
+	int i;
+
+	for (i = 0; i < nir; i++)
+		if (ir[i].op != LABEL && ir[i].op != RUNTIME
+		    && ir[i].e.value == (v & ~LMASK))
+			return (1);
+
+	return (0);
+}
+
+/*
+ * Return 1 if the store to automatic variable v at index i of block b
+ * is dead, i.e. if v is stored to again before being read or if v is
+ * never read at all.
+ */
+static int
+deadauto(const struct block *b, int i, int v)
+{
+	int j, op;
+
+	/* read anywhere? */
+	for (j = 0; j < nir; j++)
+		if (ir[j].op != DCA && ir[j].op != LABEL && ir[j].op != RUNTIME
+		    && ir[j].op != DELETED && ir[j].e.value == v)
+			break;
+
+	if (j == nir)
+		return (1);
+
+	for (j = i + 1; j < b->end; j++) {
+		op = ir[j].op;
+		if (op == DELETED || ir[j].e.value != v)
+			continue;
+
+		return (op == DCA && !iscond(j));
+	}
+
+	return (0);
+}
+
+/*
+ * Delete the store at index i of block b and the chain computing the
+ * value stored if possible.  Otherwise, replace the store with CLA.
+ */
+static void
+killstore(const struct block *b, int i)
+{
+	int j, k, zero;
+
+	for (j = i; j > b->begin && inchain(j - 1); j--)
+		;
+
+	k = j - 1;
+	if (k < b->begin || ir[k].op == LABEL)
+		zero = b->acz;
+	else
+		zero = !iscond(k) && !isskip(ir[k].op) && clearsac(k, 0);
+
+	if (zero)
+		for (; j <= i; j++)
+			kill(j);
+	else {
+		ir[i].op = CLA;
+		ir[i].e.value = INVALID;
+		ir[i].e.name[0] = '\0';
+	}
+}
+
+/*
+ * Delete dead stores in each basic block.
+ */
+static void
+deadstores(void)
+{
+	const struct block *b;
+	struct regset live, after;
+	int i, j, r, v;
+
+	for (i = 0; i < nblock; i++) {
+		b = blocks + i;
+		live = b->out;
+		after = live;
+		for (j = b->end - 1; j >= b->begin; j--) {
+			if (ir[j].op == DCA && !iscond(j)) {
+				v = ir[j].e.value;
+				r = defreg(ir + j);
+
+				/* stored, reloaded right away, and dead then? */
+				if (r >= 0 && j + 1 < b->end && ir[j + 1].op == TAD
+				    && ir[j + 1].e.value == v && !inset(&after, r)) {
+					kill(j);
+					kill(j + 1);
+					continue;
+				}
+
+				if (r >= 0 ? !inset(&live, r) :
+				    class(v) == LAUTO && !escapes(v) && deadauto(b, j, v))
+					killstore(b, j);
+			}
+
+			after = live;
+
+			r = defreg(ir + j);
+			if (r >= 0 && ir[j].op == DCA && !iscond(j))
+				delset(&live, r);
+
+			r = usereg(ir + j);
+			if (r >= 0)
+				addset(&live, r);
+		}
+	}
+
+	compact();
+}
+
+/*
+ * Insert n instructions before index i, returning 0 if there is no
+ * space for them.
+ */
+static int
+insert(int i, int n)
+{
+	if (nir + n > IRSIZ)
+		return (0);
+
+	memmove(ir + i + n, ir + i, (nir - i) * sizeof *ir);
+	nir += n;
+
+	return (1);
+}
+
+/*
+ * Conditions.  A comparison in a control expression becomes a skip
+ * over a jump right away, but when comparisons are combined with & or
+ * \, their truth values are computed as 0 or 1 and combined.  As &
+ * and \ evaluate both operands, such a combination is only turned into
+ * a sequence of conditional jumps if the right operand has no side
+ * effects.  For &, with the left truth value in stack register t,
+ *
+ *		left
+ *		truth value
+ *		DCA t
+ *		right
+ *		truth value
+ *		AND t
+ *		SNA CLA
+ *		JMP false
+ *
+ * becomes
+ *
+ *		left
+ *		skip if true
+ *		JMP false
+ *		right
+ *		skip if true
+ *		JMP false
+ *
+ * As the & of truth values is a truth value, the left operand may be
+ * another & which is rewritten in turn.  For \, the left operand
+ * instead jumps over the right one if it is true.  A truth value is
+ * either a skip with CLA followed by CLA IAC or GLK, possibly with CML.
+ */
+
+/*
+ * If the instructions before index i compute a truth value, return the
+ * index of the first one and store a skip instruction with CLA to
+ * *skip that skips if the value is true.  Otherwise return -1.
+ */
+static int
+truth(int i, int *skip)
+{
+	int op;
+
+	if (i < 1)
+		return (-1);
+
+	if (!iscond(i - 1) && (ir[i - 1].op == GLK || ir[i - 1].op == (GLK | CML))) {
+		*skip = ir[i - 1].op == GLK ? SNL | CLA : SZL | CLA;
+		return (i - 1);
+	}
+
+	if (i < 2 || ir[i - 1].op != (CLA | IAC) || iscond(i - 2))
+		return (-1);
+
+	op = ir[i - 2].op;
+	if (op & ~07777 || (op & ~00170) != (OPR2 | CLA) || (op & 00170) == 0)
+		return (-1);
+
+	*skip = op ^ 00010;
+	return (i - 2);
+}
+
+/*
+ * Return 1 if the instructions from index i to j only affect L, AC,
+ * and stack registers above t.
+ */
+static int
+pure(int i, int j, int t)
+{
+	int v;
+
+	for (; i < j; i++) {
+		v = ir[i].e.value;
+		if (ir[i].op & ~07777)
+			return (0);
+
+		switch (ir[i].op & 07000) {
+		case AND:
+		case TAD:
+			/* indirection through an auto-index register */
+			if (class(v) == LVALUE && val(v) >= 00010 && val(v) < 00020)
+				return (0);
+
+			break;
+
+		case DCA:
+			if (class(v) != RSTACK || val(v) <= t)
+				return (0);
+
+			break;
+
+		case OPR:
+			break;
+
+		default:
+			return (0);
+		}
+	}
+
+	return (1);
+}
+
+/*
+ * Return 1 if stack register r is not read after index i before being
+ * written to.
+ */
+static int
+deadafter(int r, int i)
+{
+	for (; i < nir; i++) {
+		if (usereg(ir + i) == r)
+			return (0);
+
+		if (defreg(ir + i) == r)
+			return (1);
+	}
+
+	return (1);
+}
+
+/*
+ * Return 1 if the instructions from index i compute the \ of the
+ * values in AC and a stack register like door() does before SNA CLA
+ * and a jump.
+ */
+static int
+isor(int i)
+{
+	int s, t;
+
+	if (i + 7 >= nir)
+		return (0);
+
+	s = ir[i].e.value;
+	t = ir[i + 2].e.value;
+
+	return (ir[i].op == DCA && ir[i + 1].op == TAD && ir[i + 1].e.value == s
+	    && ir[i + 2].op == AND && ir[i + 3].op == CIA
+	    && ir[i + 4].op == TAD && ir[i + 4].e.value == s
+	    && ir[i + 5].op == TAD && ir[i + 5].e.value == t
+	    && ir[i + 6].op == (SNA | CLA) && ir[i + 7].op == JMP);
+}
+
+static void
+conditions(void)
+{
+	struct ins jmp, test, label;
+	int i, k, d, l, r, n, s, t, sl, sr;
+
+	for (k = nir - 3; k >= 0; k--) {
+		if (iscond(k))
+			continue;
+
+		if (ir[k].op == AND && ir[k + 1].op == (SNA | CLA) && ir[k + 2].op == JMP) {
+			n = 1;
+			s = -1;
+		} else if (isor(k)) {
+			n = 6;
+			s = stackreg(&ir[k].e);
+		} else
+			continue;
+
+		t = stackreg(&ir[k + n - 1].e);
+		r = truth(k, &sr);
+		if (t < 0 || r < 0 || !deadafter(t, k + n + 2)
+		    || n > 1 && (s < 0 || !deadafter(s, k + n + 2)))
+			continue;
+
+		/* find where the left truth value is stored */
+		for (d = r - 1; d >= 0 && stackreg(&ir[d].e) != t; d--)
+			;
+
+		if (d < 1 || ir[d].op != DCA || iscond(d) || !pure(d + 1, r, t))
+			continue;
+
+		l = truth(d, &sl);
+		if (l < 0 && (n > 1 || ir[d - 1].op != AND || truth(d - 1, &sl) < 0
+		    || nir + 1 > IRSIZ))
+			continue;
+
+		test = ir[k + n];
+		jmp = ir[k + n + 1];
+
+		/* right operand: skip if true over the jump to false */
+		ir[r].op = sr;
+		ir[r + 1] = jmp;
+		for (i = r + 2; i <= k + n + 1; i++)
+			ir[i].op = DELETED;
+
+		if (n > 1) {
+			/* left operand: jump over the right one if true */
+			memset(&label, 0, sizeof label);
+			label.op = LABEL;
+			newlabel(&label.e);
+			ir[r + 2] = label;
+			ir[l].op = sl ^ 00010;
+			ir[l + 1].op = JMP;
+			ir[l + 1].e = label.e;
+			for (i = l + 2; i <= d; i++)
+				ir[i].op = DELETED;
+		} else if (l >= 0) {
+			/* left operand: skip if true over the jump to false */
+			ir[l].op = sl;
+			ir[l + 1] = jmp;
+			for (i = l + 2; i <= d; i++)
+				ir[i].op = DELETED;
+		} else {
+			/* left operand is another &: test it in turn */
+			ir[d] = test;
+			insert(d + 1, 1);
+			ir[d + 1] = jmp;
+		}
+	}
+
+	compact();
+}
+
+/*
+ * Jump threading.  A jump to a label followed by another jump is
+ * retargeted to the destination of that jump.  A jump to the
+ * instruction right after it is deleted; if it is conditional, the
+ * skip instruction before it loses its skip.  A skip over a jump
+ * around a single instruction is inverted to skip that instruction
+ * instead.  Labels no longer referenced afterwards are deleted so
+ * the blocks around them are merged.  Blocks that became unreachable
+ * are deleted, too.  njump counts the jumps removed.
+ */
+enum { MAXTHREAD = 010 };	/* maximum number of jumps threaded through */
+
+unsigned short njump;
+
+/*
+ * Return the number of references to label v in the current
+ * function.
+ */
+static int
+labelrefs(int v)
+{
+	int i, n = 0;
+
+	for (i = 0; i < nir; i++)
+		if (ir[i].op != LABEL && ir[i].op != RUNTIME && ir[i].op != DELETED
+		    && (class(ir[i].e.value) == RLABEL || class(ir[i].e.value) == LLABEL)
+		    && val(ir[i].e.value) == val(v))
+			n++;
+
+	return (n);
+}
+
+/*
+ * Return the index of the first instruction executed after jumping to
+ * label v or -1 if v is not in the current function.
+ */
+static int
+labelis(int v)
+{
+	int i;
+
+	for (i = 0; i < nir; i++)
+		if (ir[i].op == LABEL && ir[i].e.value == v)
+			break;
+
+	if (i == nir)
+		return (-1);
+
+	while (i < nir && ir[i].op == LABEL)
+		i++;
+
+	return (i);
+}
+
+/*
+ * Return 1 if label v is among the labels beginning at index i.
+ */
+static int
+labelat(int v, int i)
+{
+	for (; i < nir && ir[i].op == LABEL; i++)
+		if (ir[i].e.value == v)
+			return (1);
+
+	return (0);
+}
+
+/*
+ * Return 1 if the instruction at index i is a group 2 OPR instruction
+ * with a skip condition that is always executed.
+ */
+static int
+isoprskip(int i)
+{
+	int op = ir[i].op;
+
+	return (!iscond(i) && (op & ~07777) == 0 && (op & OPR2) == OPR2 && op & 00170);
+}
+
+static void
+thread(void)
+{
+	static unsigned short refs[IRSIZ];
+	int i, j, n, v, before = 0, after = 0;
+
+	for (i = 0; i < nir; i++) {
+		if (ir[i].op == LABEL)
+			refs[i] = labelrefs(ir[i].e.value);
+		else if (ir[i].op == JMP)
+			before++;
+	}
+
+	/* retarget jumps to jumps */
+	for (i = 0; i < nir; i++) {
+		if (ir[i].op != JMP)
+			continue;
+
+		for (n = 0; n < MAXTHREAD && class(ir[i].e.value) == LLABEL; n++) {
+			j = labelis(ir[i].e.value);
+			if (j < 0 || j >= nir || j == i || ir[j].op != JMP)
+				break;
+
+			ir[i].e = ir[j].e;
+		}
+	}
+
+	for (i = 0; i < nir; i++) {
+		if (ir[i].op != JMP || class(ir[i].e.value) != LLABEL)
+			continue;
+
+		v = ir[i].e.value;
+
+		/* jump to the next instruction */
+		if (labelat(v, i + 1)) {
+			if (!iscond(i))
+				ir[i].op = DELETED;
+			else if (isoprskip(i - 1)) {
+				/* keep CLA if any */
+				ir[i - 1].op &= ~00170;
+				if ((ir[i - 1].op & CLA & 00377) == 0)
+					ir[i - 1].op = DELETED;
+
+				ir[i].op = DELETED;
+			}
+
+			continue;
+		}
+
+		/* skip over a jump around one instruction */
+		if (iscond(i) && isoprskip(i - 1) && i + 2 < nir
+		    && ir[i + 1].op != LABEL && labelat(v, i + 2)) {
+			ir[i - 1].op ^= 00010;
+			ir[i].op = DELETED;
+		}
+	}
+
+	/* delete labels no longer used */
+	for (i = 0; i < nir; i++)
+		if (ir[i].op == LABEL && refs[i] > 0 && labelrefs(ir[i].e.value) == 0)
+			ir[i].op = DELETED;
+
+	compact();
+	findblocks();
+	unreachable();
+
+	for (i = 0; i < nir; i++)
+		if (ir[i].op == JMP)
+			after++;
+
+	njump = before - after;
+}
+
+/*
+ * Counted loops.  A loop of the form
+ *
+ *	top:	TAD b		or	STL
+ *		CIA STL			TAD (-b)
+ *		TAD a			TAD a
+ *		SNL CLA
+ *		JMP exit
+ *		...
+ *		ISZ a
+ *		...
+ *		JMP top
+ *	exit:
+ *
+ * as generated for while (a < b) { ... a++; } runs b - a times if a
+ * is incremented once per iteration and neither a nor b are modified
+ * otherwise.  The test is then only performed on entry, depositing
+ * a - b into a new stack register c which the loop counts up to zero
+ * with ISZ c; JMP body in place of JMP top.
+ */
+
+/*
+ * Return 1 if v is an automatic variable or parameter whose address
+ * is not taken such that only the instructions of the current function
+ * referring to v directly modify it.
+ */
+static int
+isprivate(int v)
+{
+	return ((class(v) == LAUTO || class(v) == LPARAM) && !escapes(v));
+}
+
+/*
+ * If the instructions at index i compute a - b for a private variable
+ * a and a private variable or nonzero constant b, leaving L set iff
+ * a < b, return the index of the instruction adding a.  Otherwise
+ * return -1.  A leading CLA, CLL, or CLA CLL is skipped as the
+ * comparison sets up both AC and L itself.
+ */
+static int
+cmpload(int i)
+{
+	if (i < nir && !iscond(i) && (ir[i].op | CLA | CLL) == (CLA | CLL))
+		i++;
+
+	if (i + 2 >= nir || ir[i + 2].op != TAD || !isprivate(ir[i + 2].e.value))
+		return (-1);
+
+	if (ir[i].op == TAD && ir[i + 1].op == (CIA | STL) && isprivate(ir[i].e.value))
+		return (i + 2);
+
+	if ((ir[i].op | CLA) == (CLA | STL) && ir[i + 1].op == TAD
+	    && isconst(ir[i + 1].e.value) && val(ir[i + 1].e.value) != 0)
+		return (i + 2);
+
+	return (-1);
+}
+
+/*
+ * Return 1 if label v is only referred to by jumps from index i to j.
+ */
+static int
+localabel(int v, int i, int j)
+{
+	int k;
+
+	for (k = 0; k < nir; k++) {
+		if (ir[k].op == LABEL || ir[k].op == RUNTIME || ir[k].op == DELETED
+		    || rclass(ir[k].e.value) != RLABEL || val(ir[k].e.value) != val(v))
+			continue;
+
+		if (ir[k].op != JMP || k < i || k > j)
+			return (0);
+	}
+
+	return (1);
+}
+
+/*
+ * Return 1 if none of the labels right before index t is jumped to
+ * from index t to e.  If the loop from t to e is entered through these
+ * labels, code can then be inserted before t to run on entry only.
+ */
+static int
+entryonly(int t, int e)
+{
+	int i, j;
+
+	for (i = t - 1; i >= 0 && ir[i].op == LABEL; i--)
+		for (j = t + 1; j <= e; j++)
+			if (ir[j].op == JMP && ir[j].e.value == ir[i].e.value)
+				return (0);
+
+	return (1);
+}
+
+/*
+ * Return 1 if the loop body from index i to j modifies neither the
+ * bound b nor the counter a except for a single ISZ a executed right
+ * before j in every iteration and if the loop can only be entered
+ * from the top.
+ */
+static int
+countable(int a, int b, int i, int j)
+{
+	int k, op, v, last = i, inc = -1;
+
+	for (k = i; k < j; k++) {
+		op = ir[k].op;
+		v = ir[k].e.value;
+		if (op == LABEL) {
+			if (!localabel(v, i, j))
+				return (0);
+
+			last = k;
+		} else if (op == JMP)
+			last = k;
+		else if (op == DCA || op == ISZ) {
+			if (v == b || v == a && op == DCA)
+				return (0);
+
+			if (v == a) {
+				if (inc >= 0 || iscond(k))
+					return (0);
+
+				inc = k;
+			}
+		}
+	}
+
+	return (inc > last);
+}
+
+static void
+counted(void)
+{
+	struct expr c, body;
+	struct cost old, new;
+	int i, j, a, b, top;
+
+	for (i = 0; i + 1 < nir; i++) {
+		if (ir[i].op != LABEL || ir[i + 1].op == LABEL)
+			continue;
+
+		top = ir[i].e.value;
+		a = cmpload(i + 1);
+		if (a < 0 || ir[a + 1].op != (SNL | CLA) || ir[a + 2].op != JMP
+		    || class(ir[a + 2].e.value) != LLABEL || labelrefs(top) != 1)
+			continue;
+
+		for (j = a + 3; j < nir; j++)
+			if (ir[j].op == JMP && ir[j].e.value == top)
+				break;
+
+		if (j == nir || iscond(j) || !labelat(ir[a + 2].e.value, j + 1)
+		    || !entryonly(i, j))
+			continue;
+
+		b = ir[a - 2].op == TAD ? ir[a - 2].e.value : INVALID;
+		if (!countable(ir[a].e.value, b, a + 3, j))
+			continue;
+
+		if (stacksize >= NSCRATCH / 2 || nir + 3 > IRSIZ)
+			return;
+
+		/* words added vs. time spent per iteration */
+		memset(&c, 0, sizeof c);
+		c.value = RSTACK | stacksize;
+		old = rangecost(i + 1, a + 2);
+		old.words = 0;
+		new = isncost(ISZ, &c);
+		new.words = 2;
+		if (!cheaper(new, old))
+			continue;
+
+		stacksize++;
+		memset(&body, 0, sizeof body);
+		newlabel(&body);
+
+		insert(a + 1, 1);
+		ir[a + 1].op = DCA;
+		ir[a + 1].e = c;
+
+		insert(a + 4, 1);
+		ir[a + 4].op = LABEL;
+		ir[a + 4].e = body;
+
+		j += 2;
+		ir[j].op = ISZ;
+		ir[j].e = c;
+		insert(j + 1, 1);
+		ir[j + 1].op = JMP;
+		ir[j + 1].e = body;
+
+		ir[i].op = DELETED;
+	}
+
+	compact();
+}
+
+/*
+ * Loop rotation.  A loop of the form
+ *
+ *	top:	test
+ *		skip
+ *		JMP exit
+ *	...
+ *		JMP top
+ *	exit:
+ *
+ * is rotated by copying the test to the bottom of the loop with the
+ * inverse skip condition:
+ *
+ *		test
+ *		skip
+ *		JMP exit
+ *	body:	...
+ *		test
+ *		inverse skip
+ *		JMP body
+ *	exit:
+ *
+ * As on the PDP-8 a conditional jump is a skip over a jump, this saves
+ * the jump to the exit when the loop ends, not one per iteration.  But
+ * it puts the test into the same basic block as the end of the loop
+ * body so the value numbering can forward values from the body to the
+ * test.  Only tests of up to MAXROTATE instructions are copied.
+ */
+enum { MAXROTATE = 010 };
+
+/*
+ * Return 1 if the instruction at index i is a group 1 OPR instruction
+ * that is always executed.
+ */
+static int
+isgroup1(int i)
+{
+	int op = ir[i].op;
+
+	return (!iscond(i) && (op & ~07777) == 0 && (op & OPR2) == OPR1);
+}
+
+static void
+rotate(void)
+{
+	struct ins test[MAXROTATE];
+	struct expr body;
+	struct cost old, new;
+	int i, j, k, m, top;
+
+	for (i = 0; i + 1 < nir; i++) {
+		if (ir[i].op != LABEL || ir[i + 1].op == LABEL)
+			continue;
+
+		/* find the test */
+		top = ir[i].e.value;
+		for (k = i + 1; k < nir && k <= i + MAXROTATE + 1; k++)
+			if (ir[k].op == LABEL || ir[k].op == JMP)
+				break;
+
+		if (k == nir || ir[k].op != JMP || class(ir[k].e.value) != LLABEL
+		    || !iscond(k) || !isoprskip(k - 1) || labelrefs(top) != 1)
+			continue;
+
+		/* find the jump back to the top */
+		for (j = k + 1; j < nir; j++)
+			if (ir[j].op == JMP && ir[j].e.value == top)
+				break;
+
+		if (j == nir || iscond(j) || !labelat(ir[k].e.value, j + 1)
+		    || !entryonly(i, j))
+			continue;
+
+		/* words added vs. time saved when the loop ends */
+		m = k - i - 1;
+		old = isncost(JMP, &ir[k].e);
+		old.words = 0;
+		new = rangecost(i + 1, k);
+		new.time = 0;
+		if (!cheaper(new, old) || nir + m + 1 > IRSIZ)
+			continue;
+
+		memset(&body, 0, sizeof body);
+		newlabel(&body);
+		memcpy(test, ir + i + 1, m * sizeof *ir);
+		test[m - 1].op ^= 00010;
+
+		insert(j, m);
+		memcpy(ir + j, test, m * sizeof *ir);
+		ir[j + m].e = body;
+
+		/* clearing AC and L before the test clears them? */
+		if (isgroup1(j - 1) && isgroup1(j) && (ir[j].op & (CLA | CLL)) == (CLA | CLL))
+			kill(j - 1);
+
+		insert(k + 1, 1);
+		ir[k + 1].op = LABEL;
+		ir[k + 1].e = body;
+
+		ir[i].op = DELETED;
+	}
+
+	compact();
+}
+
+/*
+ * Find the basic blocks of the current function and analyse them.
+ */
+static void
+analyse(void)
+{
+	findblocks();
+	liveness();
+	aczero();
+}
+
+/*
+ * Auto-index registers.  In a loop, a post-incremented pointer
+ * dereference like *p++ or a[i++] is computed as
+ *
+ *		TAD p			TAD i
+ *		ISZ p			ISZ i
+ *		NOP			NOP
+ *		DCA s			TAD a
+ *		...			DCA s
+ *		TAD I s			...
+ *					TAD I s
+ *
+ * with AC clear before and s dead after TAD I s (or DCA I s).  If the
+ * loop calls no B functions, modifies p (or i) nowhere else and does
+ * not modify a, an auto-index register x holding p - 1 (or a + i - 1)
+ * is set up before the loop.  Then TAD p, TAD a, and DCA s are deleted
+ * and TAD I s is replaced with TAD I x, which increments x in step
+ * with p.
+ */
+
+/*
+ * Return the block containing instruction i.
+ */
+static const struct block *
+blockof(int i)
+{
+	int j;
+
+	for (j = 0; j + 1 < nblock && blocks[j].end <= i; j++)
+		;
+
+	return (blocks + j);
+}
+
+/*
+ * If label v at index t is only referred to by jumps after index t,
+ * return the index of the last such jump.  Otherwise return -1.
+ */
+static int
+loopend(int v, int t)
+{
+	int i, e = -1;
+
+	for (i = 0; i < nir; i++) {
+		if (ir[i].op == LABEL || ir[i].op == RUNTIME
+		    || rclass(ir[i].e.value) != RLABEL || val(ir[i].e.value) != val(v))
+			continue;
+
+		if (ir[i].op != JMP || i <= t)
+			return (-1);
+
+		e = i;
+	}
+
+	return (e);
+}
+
+/*
+ * Return 1 if the instruction at index i calls a function in the B
+ * runtime.
+ */
+static int
+stdcall(int i)
+{
+	int j;
+
+	for (j = 0; j < NSTDLIB; j++)
+		if (strncmp(ir[i].e.name, stdlib[j], MAXNAME) == 0)
+			return (1);
+
+	return (0);
+}
+
+/*
+ * Return 1 if the loop from index t to e can only be entered from the
+ * top, does not call any B functions, and an auto-index register can
+ * be set up right before it.
+ */
+static int
+indexable(int t, int e)
+{
+	int i;
+
+	if (t == 0 || isskip(ir[t - 1].op) || !entryonly(t, e))
+		return (0);
+
+	for (i = t + 1; i <= e; i++) {
+		if (ir[i].op == LABEL && !localabel(ir[i].e.value, t, e))
+			return (0);
+
+		if (ir[i].op == JMS && !stdcall(i))
+			return (0);
+	}
+
+	return (1);
+}
+
+/*
+ * Return 1 if v is not modified from index i to j.  Only addresses,
+ * private variables, and global variables are considered.  As a global
+ * variable could be modified through a pointer, only stores to stack
+ * registers, zero page registers, and private variables are permitted
+ * in that case.
+ */
+static int
+invariant(int v, int i, int j)
+{
+	int w, global = 0;
+
+	switch (class(v)) {
+	case RCONST:
+	case RLABEL:
+	case RDATA:
+	case RAUTO:
+	case RPARAM:
+		return (1);
+
+	case LLABEL:
+	case LDATA:
+		global = 1;
+		break;
+
+	default:
+		if (!isprivate(v))
+			return (0);
+	}
+
+	for (; i <= j; i++) {
+		if (ir[i].op != DCA && ir[i].op != ISZ)
+			continue;
+
+		w = ir[i].e.value;
+		if (w == v || global && class(w) != RSTACK && class(w) != RVALUE
+		    && !isprivate(w))
+			return (0);
+	}
+
+	return (1);
+}
+
+/*
+ * A post-incremented pointer dereference.  The address computed is
+ * ptr + base, the increment is at index isz, the instructions
+ * computing the address are from begin to end, and the dereference
+ * is at index use.
+ */
+struct postinc {
+	int ptr, base;
+	int begin, isz, end, use;
+};
+
+/*
+ * Match a post-incremented pointer dereference beginning at index i
+ * and fill in pi.  Return 1 on success, 0 otherwise.
+ */
+static int
+postinc(struct postinc *pi, int i)
+{
+	const struct block *b;
+	struct regset live;
+	int j, r;
+
+	b = blockof(i);
+	if (ir[i].op != TAD || iscond(i) || i + 4 >= b->end || !aczat(b, i))
+		return (0);
+
+	pi->begin = j = i;
+	pi->base = INVALID;
+	if (ir[j + 1].op == TAD)
+		pi->base = ir[j++].e.value;
+
+	pi->ptr = ir[j].e.value;
+	pi->isz = j + 1;
+	if (ir[j + 1].op != ISZ || ir[j + 1].e.value != pi->ptr || ir[j + 2].op != NOP)
+		return (0);
+
+	j += 3;
+	if (pi->base == INVALID && ir[j].op == TAD)
+		pi->base = ir[j++].e.value;
+
+	if (j >= b->end || ir[j].op != DCA || (r = defreg(ir + j)) < 0)
+		return (0);
+
+	pi->end = j;
+	for (j++; j < b->end; j++) {
+		if ((ir[j].op == DCA || ir[j].op == ISZ) && ir[j].e.value == pi->ptr)
+			return (0);
+
+		if (stackreg(&ir[j].e) == r)
+			break;
+	}
+
+	if (j == b->end || iscond(j) || ir[j].op != TAD && ir[j].op != DCA
+	    || class(ir[j].e.value) != LSTACK)
+		return (0);
+
+	pi->use = j;
+	live = b->out;
+	livebefore(&live, b, j + 1);
+
+	return (!inset(&live, r));
+}
+
+/*
+ * Find a post-incremented pointer dereference in the loop from index
+ * t to e that can use an auto-index register and fill in pi.  Return 1
+ * if one was found, 0 otherwise.
+ */
+static int
+findpostinc(struct postinc *pi, int t, int e)
+{
+	struct cost old, new;
+	int i, j, n;
+
+	for (i = t + 1; i < e; i++) {
+		if (!postinc(pi, i) || !isprivate(pi->ptr))
+			continue;
+
+		if (pi->base != INVALID && !invariant(pi->base, t, e))
+			continue;
+
+		/* modified only by the increment? */
+		for (j = t, n = 0; j <= e; j++)
+			if ((ir[j].op == DCA || ir[j].op == ISZ) && ir[j].e.value == pi->ptr)
+				n++;
+
+		if (n != 1)
+			continue;
+
+		/* word added for STA vs. time saved per iteration */
+		old = rangecost(pi->begin, pi->isz);
+		addcost(&old, rangecost(pi->isz + 2, pi->end + 1));
+		old.words = 0;
+		new = isncost(STA, NULL);
+		new.time = 0;
+		if (cheaper(new, old))
+			return (1);
+	}
+
+	return (0);
+}
+
+static void
+autoindex(void)
+{
+	struct postinc pi;
+	struct ins ptr, base;
+	int t, e, x, n = 0, nset;
+
+	for (t = 0; t < nir && n < NAUTOINDEX; t++) {
+		if (ir[t].op != LABEL)
+			continue;
+
+		e = loopend(ir[t].e.value, t);
+		if (e < 0 || !indexable(t, e) || !findpostinc(&pi, t, e))
+			continue;
+
+		nset = pi.end - pi.begin;
+		if (nir + nset > IRSIZ)
+			return;
+
+		x = MINAUTOINDEX + n++;
+		ptr = ir[pi.isz - 1];
+		base = ir[pi.begin + 1 != pi.isz ? pi.begin : pi.isz + 2];
+
+		ir[pi.use].e.value = LVALUE | x;
+		ir[pi.use].e.name[0] = '\0';
+		ir[pi.begin].op = DELETED;
+		ir[pi.end].op = DELETED;
+		if (pi.begin + 1 != pi.isz)
+			ir[pi.begin + 1].op = DELETED;
+		else if (pi.isz + 2 != pi.end)
+			ir[pi.isz + 2].op = DELETED;
+
+		/* x = ptr + base - 1 */
+		insert(t, nset);
+		ir[t].op = STA;
+		ir[t].e.value = INVALID;
+		ir[t].e.name[0] = '\0';
+		ir[t + 1] = ptr;
+		if (nset == 4)
+			ir[t + 2] = base;
+
+		ir[t + nset - 1].op = DCA;
+		ir[t + nset - 1].e.value = RVALUE | x;
+		ir[t + nset - 1].e.name[0] = '\0';
+
+		compact();
+		analyse();
+		t = -1;
+	}
+}
+
+/*
+ * Loop-invariant code motion.  In a loop, a chain of TAD, AND, and
+ * group 1 OPR instructions beginning with a clear AC whose operands
+ * are not modified in the loop computes the same value in every
+ * iteration.  If the value of L left behind by the chain is not
+ * needed, the chain is computed once before the loop into a new stack
+ * register h and each copy of it in the loop is replaced with TAD h.
+ * Global variables are only considered invariant if the loop calls no
+ * B functions.  Only chains of up to MAXHOIST instructions are hoisted.
+ */
+enum { MAXHOIST = 010 };
+
+/*
+ * Return 1 if a preheader can be inserted before the loop from index
+ * t to e such that it is executed exactly when the loop is entered,
+ * with AC clear.
+ */
+static int
+preheader(int t, int e)
+{
+	int i;
+
+	if (t == 0 || isskip(ir[t - 1].op) || !blockof(t)->acz || !entryonly(t, e))
+		return (0);
+
+	for (i = t + 1; i <= e; i++)
+		if (ir[i].op == LABEL && !localabel(ir[i].e.value, t, e))
+			return (0);
+
+	return (1);
+}
+
+/*
+ * Return 1 if L is set before it is read from index i on.
+ */
+static int
+ldead(int i)
+{
+	int op;
+
+	for (; i < nir; i++) {
+		op = ir[i].op;
+		if (op == LABEL || op == RUNTIME)
+			return (1);
+
+		if (op & ~07777)
+			continue;
+
+		switch (op & 07000) {
+		case JMS:
+			return (1);
+
+		case JMP:
+			if (!iscond(i))
+				return (1);
+
+			break;
+
+		case OPR:
+			if ((op & OPR2) == OPR2) {
+				if (op & 00020)
+					return (0);
+			} else if (op & 00036)
+				return (0);
+			else if (op & 00100 && !iscond(i))
+				return (1);
+
+			break;
+		}
+	}
+
+	return (1);
+}
+
+/*
+ * Return the length of the longest chain of loop-invariant instructions
+ * at index i in the loop from index t to e, but at most n.  If calls is
+ * set, global variables are not invariant.
+ */
+static int
+chainlen(int i, int n, int t, int e, int calls)
+{
+	int j, op, v;
+
+	for (j = i; j < i + n && j < e; j++) {
+		op = ir[j].op;
+		v = ir[j].e.value;
+		if (iscond(j) || op & ~07777)
+			break;
+
+		if (op == TAD || op == AND) {
+			if (!invariant(v, t, e)
+			    || calls && (class(v) == LLABEL || class(v) == LDATA))
+				break;
+		} else if ((op & OPR2) != OPR1 || op & 00014)
+			break;
+	}
+
+	return (j - i);
+}
+
+/*
+ * Return 1 if the n instructions at index i form a chain that can be
+ * replaced with a load of its value: AC is clear before it, it lies in
+ * a single basic block, and L is dead after it.
+ */
+static int
+replaceable(int i, int n)
+{
+	const struct block *b = blockof(i);
+
+	return (!iscond(i) && i + n <= b->end && aczat(b, i) && ldead(i + n));
+}
+
+/*
+ * Return 1 if the n instructions at indices i and j are the same.
+ */
+static int
+samechain(int i, int j, int n)
+{
+	int k;
+
+	for (k = 0; k < n; k++)
+		if (ir[i + k].op != ir[j + k].op || ir[i + k].e.value != ir[j + k].e.value)
+			return (0);
+
+	return (1);
+}
+
+/*
+ * Return a stack register neither live on entry to the loop from index
+ * t to e nor used in it.  If there is none, return stacksize.
+ */
+static int
+loopreg(int t, int e)
+{
+	int r;
+
+	for (r = 0; r < stacksize; r++)
+		if (!inset(&blockof(t)->in, r) && !refers(r, t, e + 1))
+			break;
+
+	return (r);
+}
+
+/*
+ * Return 1 if the loop from index t to e calls a B function.
+ */
+static int
+loopcalls(int t, int e)
+{
+	int i;
+
+	for (i = t; i <= e; i++)
+		if (ir[i].op == JMS && !stdcall(i))
+			return (1);
+
+	return (0);
+}
+
+static void
+hoist(void)
+{
+	static unsigned short occ[IRSIZ];
+	struct ins chain[MAXHOIST];
+	struct expr h;
+	struct cost c, tad, dca, old, new;
+	int t, e, i, j, k, n, nocc, calls, words;
+	long time;
+
+	for (t = 0; t < nir; t++) {
+		if (ir[t].op != LABEL)
+			continue;
+
+		e = loopend(ir[t].e.value, t);
+		if (e < 0 || !preheader(t, e))
+			continue;
+
+		calls = loopcalls(t, e);
+		for (i = t + 1; i < e; i++) {
+			n = chainlen(i, MAXHOIST, t, e, calls);
+			if (n == 0 || !replaceable(i, n))
+				continue;
+
+			/* find all copies of the chain */
+			for (k = i, nocc = 0; k + n <= e; k++)
+				if (samechain(i, k, n) && replaceable(k, n)) {
+					occ[nocc++] = k;
+					k += n - 1;
+				}
+
+			memset(&h, 0, sizeof h);
+			h.value = RSTACK | loopreg(t, e);
+
+			/*
+			 * Words added and time spent once vs. time saved
+			 * in LOOPITER iterations.  The template registers of
+			 * the chain remain in use.  A new stack register must
+			 * be saved and restored on every call and takes a word
+			 * in the frame.
+			 */
+			c = rangecost(i, i + n);
+			tad = isncost(TAD, &h);
+			dca = isncost(DCA, &h);
+			words = n + 1 - nocc * (n - 1);
+			time = nocc * (c.time - tad.time);
+			if (time <= 0)
+				continue;
+
+			new.time = c.time + dca.time;
+			if (val(h.value) == stacksize) {
+				words++;
+				new.time += 2 * (tad.time + dca.time);
+			}
+
+			new.words = words > 0 ? words : 0;
+			old.words = words < 0 ? -words : 0;
+			old.time = LOOPITER * time;
+			if (!cheaper(new, old))
+				continue;
+
+			if (nir + n + 1 > IRSIZ)
+				return;
+
+			if (val(h.value) == stacksize) {
+				if (stacksize >= NSCRATCH / 2)
+					return;
+
+				stacksize++;
+			}
+
+			memcpy(chain, ir + i, n * sizeof *ir);
+			for (j = 0; j < nocc; j++) {
+				ir[occ[j]].op = TAD;
+				ir[occ[j]].e = h;
+				for (k = occ[j] + 1; k < occ[j] + n; k++)
+					ir[k].op = DELETED;
+			}
+
+			/* h = chain */
+			insert(t, n + 1);
+			memcpy(ir + t, chain, n * sizeof *ir);
+			ir[t + n].op = DCA;
+			ir[t + n].e = h;
+
+			compact();
+			analyse();
+			t = -1;
+			break;
+		}
+	}
+}
+
+/*
+ * Induction variables.  In a loop, an array element v[i] is addressed
+ * as
+ *
+ *		TAD v
+ *		TAD i
+ *		DCA s
+ *		...
+ *		TAD I s
+ *
+ * with AC clear before TAD v and s dead after its last use.  If v is
+ * not modified in the loop and i only by unconditional ISZ i; NOP, the
+ * address moves in step with i.  It is then computed once before the
+ * loop into a stack register q, s is replaced with q, and each ISZ i
+ * is followed by ISZ q.  If the loop calls no B functions, increments
+ * i only once, and s is used once with neither a label nor a jump
+ * between the top of the loop and these, an auto-index register x
+ * holding v + i - 1 (or v + i if the use comes after the increment)
+ * is set up instead, taking the place of s in TAD I s.  Finally, if a
+ * variable only incremented in a loop is dead once the loop is left,
+ * its increments are deleted.
+ */
+
+/*
+ * An array element access.  The address iv + base is computed from
+ * index begin on and last used at index last.
+ */
+struct element {
+	int iv, base;
+	int begin, last;
+};
+
+/*
+ * Delete the computation of the discarded value of a post-increment
+ * TAD v; ISZ v; NOP; CLA CLL if AC is clear before it.
+ */
+static void
+discard(void)
+{
+	int i;
+
+	for (i = 0; i + 3 < nir; i++) {
+		if (ir[i].op != TAD || iscond(i) || ir[i + 1].op != ISZ
+		    || ir[i + 1].e.value != ir[i].e.value || ir[i + 2].op != NOP
+		    || ir[i + 3].op != (CLA | CLL) || !aczat(blockof(i), i))
+			continue;
+
+		ir[i].op = DELETED;
+		ir[i + 3].op = ldead(i + 4) ? DELETED : CLL;
+	}
+
+	compact();
+	analyse();
+}
+
+/*
+ * If v is a private variable modified in the loop from index t to e
+ * only by unconditional ISZ v; NOP, return the number of such
+ * increments.  Otherwise return 0.
+ */
+static int
+steps(int v, int t, int e)
+{
+	int i, n = 0;
+
+	if (!isprivate(v))
+		return (0);
+
+	for (i = t; i <= e; i++) {
+		if (ir[i].op != DCA && ir[i].op != ISZ || ir[i].e.value != v)
+			continue;
+
+		if (ir[i].op != ISZ || iscond(i) || i + 1 > e || ir[i + 1].op != NOP)
+			return (0);
+
+		n++;
+	}
+
+	return (n);
+}
+
+/*
+ * Return how often the instruction at index i is assumed to be
+ * executed per iteration of the loop from index t to e, that is,
+ * LOOPITER times for each loop nested in it that contains i.
+ */
+static long
+frequency(int i, int t, int e)
+{
+	long n = 1;
+	int k, f;
+
+	for (k = t + 1; k < i; k++)
+		if (ir[k].op == LABEL && (f = loopend(ir[k].e.value, k)) >= i && f <= e)
+			n *= LOOPITER;
+
+	return (n);
+}
+
+/*
+ * Return the number of times v is incremented per iteration of the
+ * loop from index t to e, weighted as by frequency().
+ */
+static long
+stepfreq(int v, int t, int e)
+{
+	long n = 0;
+	int i;
+
+	for (i = t; i <= e; i++)
+		if (ir[i].op == ISZ && ir[i].e.value == v)
+			n += frequency(i, t, e);
+
+	return (n);
+}
+
+/*
+ * Match an array element access at index i in the loop from index t
+ * to e and fill in ac.  If calls is set, global variables are not
+ * invariant.  Return 1 on success, 0 otherwise.
+ */
+static int
+element(struct element *ac, int i, int t, int e, int calls)
+{
+	const struct block *b = blockof(i);
+	struct regset live;
+	int j, r, v;
+
+	if (i + 3 > b->end || ir[i].op != TAD || ir[i + 1].op != TAD
+	    || (r = defreg(ir + i + 2)) < 0 || ir[i + 2].op != DCA
+	    || iscond(i) || !aczat(b, i) || !ldead(i + 3))
+		return (0);
+
+	if (steps(ir[i].e.value, t, e) > 0) {
+		ac->iv = ir[i].e.value;
+		ac->base = ir[i + 1].e.value;
+	} else if (steps(ir[i + 1].e.value, t, e) > 0) {
+		ac->iv = ir[i + 1].e.value;
+		ac->base = ir[i].e.value;
+	} else
+		return (0);
+
+	v = ac->base;
+	if (!invariant(v, t, e) || calls && (class(v) == LLABEL || class(v) == LDATA))
+		return (0);
+
+	/* uses of s before i is incremented or s is overwritten */
+	ac->begin = i;
+	ac->last = -1;
+	for (j = i + 3; j < b->end; j++) {
+		if (ir[j].op == ISZ && ir[j].e.value == ac->iv)
+			break;
+
+		if (defreg(ir + j) == r) {
+			if (ir[j].op == ISZ)
+				return (0);
+
+			break;
+		}
+
+		if (stackreg(&ir[j].e) == r)
+			ac->last = j;
+	}
+
+	if (ac->last < 0)
+		return (0);
+
+	live = b->out;
+	livebefore(&live, b, ac->last + 1);
+
+	return (!inset(&live, r));
+}
+
+/*
+ * If access ac in the loop from index t to e can use an auto-index
+ * register, return the index of the increment of its induction
+ * variable.  Otherwise return -1.
+ */
+static int
+lockstep(const struct element *ac, int t, int e)
+{
+	int i, op, r, end, isz = -1;
+
+	r = val(ir[ac->begin + 2].e.value);
+	if (refers(r, ac->begin + 3, ac->last) || iscond(ac->last)
+	    || class(ir[ac->last].e.value) != LSTACK
+	    || ir[ac->last].op != TAD && ir[ac->last].op != DCA)
+		return (-1);
+
+	for (i = t; i <= e; i++)
+		if (ir[i].op == ISZ && ir[i].e.value == ac->iv) {
+			if (isz >= 0)
+				return (-1);
+
+			isz = i;
+		}
+
+	end = isz > ac->last ? isz : ac->last;
+	for (i = t + 1; i < end; i++) {
+		op = ir[i].op;
+		if (op == LABEL || (op & ~07777) == 0 && (op & 07000) == JMP)
+			return (-1);
+	}
+
+	return (isz);
+}
+
+/*
+ * Return an auto-index register not used in the current function or
+ * -1 if there is none.
+ */
+static int
+freeindex(void)
+{
+	int i, x;
+
+	for (x = MINAUTOINDEX; x < MINAUTOINDEX + NAUTOINDEX; x++) {
+		for (i = 0; i < nir; i++)
+			if (ir[i].op != LABEL && ir[i].op != RUNTIME
+			    && rclass(ir[i].e.value) == RVALUE && val(ir[i].e.value) == x)
+				break;
+
+		if (i == nir)
+			return (x);
+	}
+
+	return (-1);
+}
+
+/*
+ * Replace access ac in the loop beginning at index t with auto-index
+ * register x.  The increment of its induction variable is at index isz.
+ */
+static void
+useindex(const struct element *ac, int t, int x, int isz)
+{
+	struct ins a, b;
+	int i = t;
+
+	a = ir[ac->begin];
+	b = ir[ac->begin + 1];
+	ir[ac->last].e.value = LVALUE | x;
+	ir[ac->last].e.name[0] = '\0';
+	ir[ac->begin].op = DELETED;
+	ir[ac->begin + 1].op = DELETED;
+	ir[ac->begin + 2].op = DELETED;
+
+	/* x = v + i - 1 or x = v + i */
+	if (isz > ac->last) {
+		insert(t, 4);
+		ir[i].op = STA;
+		ir[i].e.value = INVALID;
+		ir[i++].e.name[0] = '\0';
+	} else
+		insert(t, 3);
+
+	ir[i++] = a;
+	ir[i++] = b;
+	ir[i].op = DCA;
+	ir[i].e.value = RVALUE | x;
+	ir[i].e.name[0] = '\0';
+}
+
+/*
+ * Replace access ac in the loop from index t to e with a stack register
+ * q incremented alongside its induction variable.
+ */
+static void
+usestep(const struct element *ac, int t, int e, const struct expr *q)
+{
+	struct ins a, b;
+	int i;
+
+	a = ir[ac->begin];
+	b = ir[ac->begin + 1];
+	renamereg(val(ir[ac->begin + 2].e.value), val(q->value), ac->begin + 3, ac->last + 1);
+	ir[ac->begin].op = DELETED;
+	ir[ac->begin + 1].op = DELETED;
+	ir[ac->begin + 2].op = DELETED;
+
+	for (i = e; i >= t; i--) {
+		if (ir[i].op != ISZ || ir[i].e.value != ac->iv)
+			continue;
+
+		insert(i + 2, 2);
+		ir[i + 2].op = ISZ;
+		ir[i + 2].e = *q;
+		ir[i + 3].op = NOP;
+		ir[i + 3].e.value = INVALID;
+		ir[i + 3].e.name[0] = '\0';
+	}
+
+	/* q = v + i */
+	insert(t, 3);
+	ir[t] = a;
+	ir[t + 1] = b;
+	ir[t + 2].op = DCA;
+	ir[t + 2].e = *q;
+}
+
+/*
+ * Return 1 if private variable v may be read after the loop from index
+ * t to e is left before it is stored to.
+ */
+static int
+liveout(int v, int t, int e)
+{
+	static unsigned char seen[IRSIZ];
+	static short work[IRSIZ];
+	const struct block *b;
+	int i, j, n = 0, s[2];
+
+	for (i = 0; i < nblock; i++)
+		seen[i] = blocks[i].begin >= t && blocks[i].begin <= e;
+
+	/* the exits of the loop */
+	for (i = 0; i < nblock; i++) {
+		if (blocks[i].begin < t || blocks[i].begin > e)
+			continue;
+
+		if (blocks[i].anywhere)
+			return (1);
+
+		s[0] = blocks[i].jump;
+		s[1] = blocks[i].next;
+		for (j = 0; j < 2; j++)
+			if (s[j] != NOBLOCK && !seen[s[j]]) {
+				seen[s[j]] = 1;
+				work[n++] = s[j];
+			}
+	}
+
+	while (n > 0) {
+		b = blocks + work[--n];
+		for (i = b->begin; i < b->end; i++)
+			if (ir[i].op != LABEL && ir[i].op != RUNTIME && ir[i].e.value == v
+			    && (ir[i].op != DCA || !iscond(i)))
+				break;
+
+		if (i < b->end) {
+			if (ir[i].op != DCA)
+				return (1);
+
+			continue;
+		}
+
+		if (b->anywhere)
+			return (1);
+
+		s[0] = b->jump;
+		s[1] = b->next;
+		for (j = 0; j < 2; j++)
+			if (s[j] != NOBLOCK && !seen[s[j]]) {
+				seen[s[j]] = 1;
+				work[n++] = s[j];
+			}
+	}
+
+	return (0);
+}
+
+/*
+ * Delete the increments of variables only incremented in a loop and
+ * dead after it.
+ */
+static void
+deadsteps(void)
+{
+	int t, e, i, j, v;
+
+	for (t = 0; t < nir; t++) {
+		if (ir[t].op != LABEL || (e = loopend(ir[t].e.value, t)) < 0)
+			continue;
+
+		for (i = t + 1; i < e; i++) {
+			v = ir[i].e.value;
+			if (ir[i].op != ISZ || steps(v, t, e) == 0)
+				continue;
+
+			/* read elsewhere in the loop? */
+			for (j = t; j <= e; j++)
+				if (ir[j].op != ISZ && ir[j].op != LABEL
+				    && ir[j].op != RUNTIME && ir[j].e.value == v)
+					break;
+
+			if (j <= e || liveout(v, t, e))
+				continue;
+
+			for (j = t; j <= e; j++)
+				if (ir[j].op == ISZ && ir[j].e.value == v)
+					ir[j].op = ir[j + 1].op = DELETED;
+
+			compact();
+			analyse();
+			t = -1;
+			break;
+		}
+	}
+}
+
+static void
+induction(void)
+{
+	struct element ac;
+	struct expr q;
+	struct cost c, d, step, old, new;
+	int t, e, i, x, n, calls, words, isz = -1;
+	long time;
+
+	discard();
+	for (t = 0; t < nir; t++) {
+		if (ir[t].op != LABEL)
+			continue;
+
+		e = loopend(ir[t].e.value, t);
+		if (e < 0 || !preheader(t, e))
+			continue;
+
+		calls = loopcalls(t, e);
+		for (i = t + 1; i < e; i++) {
+			if (!element(&ac, i, t, e, calls))
+				continue;
+
+			/* cost of computing the address once */
+			c = rangecost(i, i + 3);
+			new = rangecost(i, i + 2);
+			memset(&q, 0, sizeof q);
+			x = -1;
+			if (indexable(t, e) && (isz = lockstep(&ac, t, e)) >= 0)
+				x = freeindex();
+
+			/*
+			 * Words added and time spent once vs. time saved
+			 * in LOOPITER iterations, as for hoisting.  Code in
+			 * inner loops runs more often than once an iteration.
+			 */
+			if (x >= 0) {
+				q.value = LVALUE | x;
+				d = isncost(ir[ac.last].op, &ir[ac.last].e);
+				addcost(&c, d);
+				d = isncost(ir[ac.last].op, &q);
+				q.value = RVALUE | x;
+				addcost(&new, isncost(DCA, &q));
+				if (isz > ac.last)
+					addcost(&new, isncost(STA, NULL));
+
+				n = new.words + d.words;
+				time = frequency(i, t, e) * (c.time - d.time);
+			} else {
+				q.value = RSTACK | loopreg(t, e);
+				step = isncost(ISZ, &q);
+				addcost(&step, isncost(NOP, NULL));
+				addcost(&new, isncost(DCA, &q));
+				time = frequency(i, t, e) * c.time
+				    - stepfreq(ac.iv, t, e) * step.time;
+				n = new.words + steps(ac.iv, t, e) * step.words;
+				if (val(q.value) == stacksize) {
+					n++;
+					d = isncost(TAD, &q);
+					addcost(&d, isncost(DCA, &q));
+					new.time += 2 * d.time;
+				}
+			}
+
+			if (time <= 0)
+				continue;
+
+			words = n - c.words;
+			new.words = words > 0 ? words : 0;
+			old.words = words < 0 ? -words : 0;
+			old.time = LOOPITER * time;
+			if (!cheaper(new, old))
+				continue;
+
+			if (nir + 4 + 2 * steps(ac.iv, t, e) > IRSIZ)
+				return;
+
+			if (x >= 0)
+				useindex(&ac, t, x, isz);
+			else {
+				if (val(q.value) == stacksize) {
+					if (stacksize >= NSCRATCH / 2)
+						return;
+
+					stacksize++;
+				}
+
+				usestep(&ac, t, e, &q);
+			}
+
+			compact();
+			analyse();
+			t = -1;
+			break;
+		}
+	}
+
+	deadsteps();
+}
+
+/*
+ * Register allocation.  Automatic variables whose address is not taken
+ * are moved to new stack registers, so they are accessed directly in
+ * zero page instead of through a template pointing into the automatic
+ * variable area.  Only the remaining automatic variables keep a slot
+ * in that area.  Parameters whose address is not taken are moved the
+ * same way if they are accessed often enough to pay for copying them
+ * to their stack register on entry and for saving that register.  Then
+ * the stack registers are numbered anew: two registers interfere if
+ * one is written while the other is live.  Each register in turn gets
+ * the lowest number not given to a register it interferes with, so
+ * values with disjoint live ranges share a register.
+ */
+
+/*
+ * Move the private variable at index i to stack register r.
+ */
+static void
+moveto(int i, int r)
+{
+	int v = ir[i].e.value;
+
+	for (; i < nir; i++)
+		if (ir[i].op != LABEL && ir[i].op != RUNTIME && ir[i].e.value == v)
+			ir[i].e.value = RSTACK | r;
+}
+
+/*
+ * Return 1 if moving parameter v to stack register r is cheaper than
+ * leaving it in the parameter area.  Accesses in loops are assumed to
+ * be executed LOOPITER times.
+ */
+static int
+movable(int v, int r)
+{
+	struct expr p, s;
+	struct cost c, d, old = { 0, 0 }, new;
+	int i, n;
+
+	memset(&p, 0, sizeof p);
+	memset(&s, 0, sizeof s);
+	p.value = v;
+	s.value = RSTACK | r;
+	for (i = 0; i < nir; i++) {
+		if (ir[i].op == LABEL || ir[i].op == RUNTIME || ir[i].e.value != v)
+			continue;
+
+		n = blockof(i)->loop ? LOOPITER : 1;
+		c = isncost(ir[i].op, &p);
+		d = isncost(ir[i].op, &s);
+		old.time += n * (c.time - d.time);
+	}
+
+	/* copy on entry, save and restore the register */
+	new = isncost(TAD, &p);
+	addcost(&new, isncost(DCA, &s));
+	c = isncost(TAD, &s);
+	addcost(&c, isncost(DCA, &s));
+	new.words++;
+	new.time += 2 * c.time;
+
+	return (cheaper(new, old));
+}
+
+/*
+ * Move private automatic variables and parameters to stack registers.
+ */
+static void
+promote(void)
+{
+	struct ins p;
+	int i, v;
+
+	findblocks();
+	for (i = 0; i < nir; i++) {
+		v = ir[i].e.value;
+		if (ir[i].op == LABEL || ir[i].op == RUNTIME || !isprivate(v))
+			continue;
+
+		if (stacksize >= NSCRATCH / 2 || nir + 2 > IRSIZ)
+			return;
+
+		if (class(v) == LAUTO) {
+			moveto(i, stacksize++);
+			continue;
+		}
+
+		if (!movable(v, stacksize))
+			continue;
+
+		/* copy the parameter on entry, before any loop to the body */
+		p = ir[i];
+		moveto(i, stacksize);
+		insert(0, 2);
+		ir[0].op = TAD;
+		ir[0].e = p.e;
+		ir[0].e.value = v;
+		ir[1].op = DCA;
+		ir[1].e = p.e;
+		ir[1].e.value = RSTACK | stacksize++;
+		i += 2;
+		findblocks();
+	}
+}
+
+/*
+ * Return 1 if the instructions from index i to j may be moved after the
+ * chain from index c to d: they neither call functions nor store to
+ * anything but stack registers and zero page registers not referred to
+ * by the chain, and the chain refers to no zero page registers but stack
+ * registers.
+ */
+static int
+independent(int i, int j, int c, int d)
+{
+	int k, r, op, v;
+
+	for (k = c; k < d; k++)
+		if (rclass(ir[k].e.value) == RVALUE)
+			return (0);
+
+	for (k = i; k < j; k++) {
+		op = ir[k].op;
+		v = ir[k].e.value;
+		if (op == JMS || op == ISZ || op == LABEL || op == WORD)
+			return (0);
+
+		if (op == DCA) {
+			if (class(v) != RSTACK && class(v) != RVALUE)
+				return (0);
+
+			r = defreg(ir + k);
+			if (r >= 0 && refers(r, c, d))
+				return (0);
+		}
+	}
+
+	return (1);
+}
+
+/*
+ * Evaluate the operands of + and & such that fewer stack registers are
+ * live at once.  The left operand is computed first and kept in a stack
+ * register t while the right operand is computed:
+ *
+ *		left			right
+ *		DCA t			DCA t
+ *		right			left
+ *		TAD t			TAD t
+ *
+ * If the left operand is a chain needing no stack register but the
+ * right operand stores intermediate values to stack registers, these
+ * interfere with t.  As in Sethi-Ullman numbering, the operand needing
+ * more registers is then computed first, provided the right operand
+ * does not modify anything the left one reads and L is not needed.
+ */
+static void
+reorder(void)
+{
+	static struct ins tmp[IRSIZ];
+	const struct block *b;
+	struct regset live;
+	int i, c, d, u, n, m, r, temps;
+
+	analyse();
+	for (i = 0; i < nblock; i++) {
+		b = blocks + i;
+		for (d = b->begin; d < b->end; d++) {
+			if (ir[d].op != DCA || iscond(d) || (r = defreg(ir + d)) < 0)
+				continue;
+
+			for (c = d; c > b->begin && inchain(c - 1); c--)
+				;
+
+			if (c == d || iscond(c) || !aczat(b, c) || refers(r, c, d))
+				continue;
+
+			/* the use of t and the temporaries of the right operand */
+			temps = 0;
+			for (u = d + 1; u < b->end && stackreg(&ir[u].e) != r; u++)
+				if (ir[u].op == DCA && defreg(ir + u) >= 0)
+					temps = 1;
+
+			if (u == b->end || !temps || iscond(u) || class(ir[u].e.value) != RSTACK
+			    || ir[u].op != TAD && ir[u].op != AND
+			    || !independent(d + 1, u, c, d) || !ldead(d + 1) || !ldead(u + 1))
+				continue;
+
+			live = b->out;
+			livebefore(&live, b, u + 1);
+			if (inset(&live, r))
+				continue;
+
+			n = d - c;
+			m = u - d - 1;
+			memcpy(tmp, ir + c, (n + 1) * sizeof *ir);
+			memmove(ir + c, ir + d + 1, m * sizeof *ir);
+			ir[c + m] = tmp[n];
+			memcpy(ir + c + m + 1, tmp, n * sizeof *ir);
+			d = u;
+		}
+	}
+}
+
+/*
+ * Renumber the automatic variables left in the automatic variable area,
+ * keeping their order, so no space is reserved for those moved to stack
+ * registers or not used at all.
+ */
+static void
+renumber(void)
+{
+	unsigned char map[0400];
+	int i, v, n = 0;
+
+	memset(map, 0, sizeof map);
+	for (i = 0; i < nir; i++)
+		if (ir[i].op != LABEL && ir[i].op != RUNTIME && rclass(ir[i].e.value) == RAUTO)
+			map[val(ir[i].e.value)] = 1;
+
+	for (i = 0; i < nauto; i++)
+		if (map[i])
+			map[i] = n++;
+
+	for (i = 0; i < nir; i++) {
+		v = ir[i].e.value;
+		if (ir[i].op != LABEL && ir[i].op != RUNTIME && rclass(v) == RAUTO)
+			ir[i].e.value = v & ~07777 | map[val(v)];
+	}
+
+	nauto = n;
+}
+
+/*
+ * Number the stack registers anew such that registers that do not
+ * interfere may share a number.
+ */
+static void
+color(void)
+{
+	static struct regset inter[NSCRATCH];
+	struct regset live, used;
+	unsigned char map[NSCRATCH];
+	const struct block *b;
+	int i, j, r, s, c, n = 0;
+
+	analyse();
+	memset(inter, 0, sizeof inter);
+	memset(&used, 0, sizeof used);
+	for (i = 0; i < nblock; i++) {
+		b = blocks + i;
+		live = b->out;
+		for (j = b->end - 1; j >= b->begin; j--) {
+			r = defreg(ir + j);
+			if (r >= 0) {
+				addset(&used, r);
+				for (s = 0; s < stacksize; s++)
+					if (s != r && inset(&live, s)) {
+						addset(inter + r, s);
+						addset(inter + s, r);
+					}
+
+				if (ir[j].op == DCA && !iscond(j))
+					delset(&live, r);
+			}
+
+			r = usereg(ir + j);
+			if (r >= 0) {
+				addset(&used, r);
+				addset(&live, r);
+			}
+		}
+	}
+
+	for (r = 0; r < stacksize; r++) {
+		if (!inset(&used, r))
+			continue;
+
+		for (c = 0;; c++) {
+			for (s = 0; s < r; s++)
+				if (inset(&used, s) && map[s] == c && inset(inter + r, s))
+					break;
+
+			if (s == r)
+				break;
+		}
+
+		map[r] = c;
+		if (c >= n)
+			n = c + 1;
+	}
+
+	for (i = 0; i < nir; i++)
+		if (ir[i].op != LABEL && ir[i].op != RUNTIME && (r = stackreg(&ir[i].e)) >= 0)
+			ir[i].e.value = ir[i].e.value & ~07777 | map[r];
+
+	stacksize = n;
+}
+
+static void
+allocate(void)
+{
+	promote();
+	renumber();
+	reorder();
+	color();
+}
+
+/*
+ * Compute the effect of group 1 instruction op on L:AC.  Bit 13 of lac
+ * is set if L is not known.  Return -1 if the result depends on the
+ * unknown L or cannot be computed.
+ */
+static int
+oprlac(int op, int lac)
+{
+	if (op & CLA & 00377)
+		lac &= ~07777;
+
+	if (op & CLL & 00377)
+		lac &= ~030000;
+
+	if (op & CMA & 00377)
+		lac ^= 07777;
+
+	if (op & CML & 00377)
+		lac ^= 010000;
+
+	if (op & IAC & 00377)
+		lac = lac & 020000 | (lac & 017777) + 1 & 017777;
+
+	if (op & BSW & 00377 && (op & (RAR | RAL) & 00377) == 0)
+		return (-1);
+
+	if (op & (RAR | RAL) & 00377 && lac & 020000)
+		return (-1);
+
+	if (op & RAL & 00377) {
+		lac = (lac << 1 | lac >> 12) & 017777;
+		if (op & BSW & 00377)
+			lac = (lac << 1 | lac >> 12) & 017777;
+	} else if (op & RAR & 00377) {
+		lac = (lac >> 1 | lac << 12) & 017777;
+		if (op & BSW & 00377)
+			lac = (lac >> 1 | lac << 12) & 017777;
+	}
+
+	return (lac);
+}
+
+/*
+ * Stack registers set to a constant right after entry, typically
+ * initialised automatic variables, can be loaded from the frame
+ * template by the prologue instead.  Copying a template register is
+ * assumed to cost two instructions in the prologue and a word in the
+ * template.  This is not possible if a tail call jumps back to the
+ * beginning of the function body as the registers are set again then.
+ * The registers preloaded are numbered first so they directly follow
+ * the template registers.
+ *
+ * stackinit, ninit
+ *     the initial values of stack registers 0 to ninit - 1
+ */
+unsigned short stackinit[NSCRATCH];
+unsigned char ninit;
+
+extern void
+preload(void)
+{
+	struct cost tmpl = { 1, 4 };
+	unsigned short init[NSCRATCH];
+	unsigned char map[NSCRATCH], isinit[NSCRATCH];
+	struct cost code;
+	int i, j, k, r, op, lac, n;
+
+	tmpl.time *= cpu->cycle;
+	ninit = 0;
+	memset(isinit, 0, sizeof isinit);
+	for (i = 0; i < nir && ir[i].op == LABEL; i++)
+		if (labelrefs(ir[i].e.value) > 0)
+			return;
+
+	/* each part of the entry code ends with a DCA leaving AC clear */
+	for (; i < nir; i = j + 1) {
+		code.words = 0;
+		code.time = 0;
+		lac = 020000;
+		for (j = i; j < nir && ir[j].op != DCA; j++) {
+			op = ir[j].op;
+			if (op & ~07777 || isskip(op))
+				goto done;
+
+			if ((op & 07400) == OPR1)
+				lac = lac < 0 ? -1 : oprlac(op, lac);
+			else if (op == TAD || op == AND) {
+				if (lac < 0 || !isconst(ir[j].e.value))
+					lac = -1;
+				else if (op == TAD)
+					lac = lac & 020000 | (lac & 017777) + val(ir[j].e.value) & 017777;
+				else
+					lac &= ir[j].e.value | 030000;
+			} else
+				goto done;
+
+			addcost(&code, isncost(op, &ir[j].e));
+		}
+
+		if (j == nir)
+			break;
+
+		addcost(&code, isncost(DCA, &ir[j].e));
+		if (lac < 0 || class(ir[j].e.value) != RSTACK || !cheaper(tmpl, code)
+		    || !ldead(j + 1))
+			continue;
+
+		r = val(ir[j].e.value);
+		if (refers(r, 0, i))
+			continue;
+
+		isinit[r] = 1;
+		init[r] = lac & 07777;
+		for (k = i; k <= j; k++)
+			ir[k].op = DELETED;
+	}
+
+done:	compact();
+
+	/* number the preloaded registers first */
+	for (r = 0; r < stacksize; r++)
+		if (isinit[r]) {
+			stackinit[ninit] = init[r];
+			map[r] = ninit++;
+		}
+
+	if (ninit == 0)
+		return;
+
+	for (r = 0, n = ninit; r < stacksize; r++)
+		if (!isinit[r])
+			map[r] = n++;
+
+	for (i = 0; i < nir; i++)
+		if (ir[i].op != LABEL && ir[i].op != RUNTIME && (r = stackreg(&ir[i].e)) >= 0)
+			ir[i].e.value = ir[i].e.value & ~07777 | map[r];
+}
+
+extern void
+optimise(void)
+{
+	ndead = 0;
+	conditions();
+	findblocks();
+	unreachable();
+	thread();
+	counted();
+	rotate();
+	analyse();
+	cse();
+	analyse();
+	deadstores();
+	analyse();
+	autoindex();
+	induction();
+	hoist();
+	allocate();
+}
@@ -0,0 +1,82 @@
+/*- (c) 2019 Robert Clausecker <fuz@fuz.su> */
+/* opt.h -- optimisation passes */
+
+/*
+ * The intermediate representation.  The instructions selected for the
+ * body of the current function are not emitted right away but
+ * collected in ir.  In addition to PDP-8 instructions, the following
+ * pseudo instructions are used:
+ *
+ * LABEL
+ *     place label e
+ *
+ * WORD
+ *     emit the address of e like emitl() does, e.g. for the arguments
+ *     of a function call
+ *
+ * RUNTIME
+ *     call the runtime routine named e.name
+ *
+ * The instructions are divided into basic blocks.  A block begins at
+ * each label and after each JMP instruction.  As a skip instruction
+ * only affects the instruction right after it, skips do not end a
+ * block.  Once the function ends, the optimisation passes are run over
+ * ir and then the operands are spilled and the instructions printed.
+ *
+ * ir, nir
+ *     the instructions of the current function
+ *
+ * stacksize
+ *     the number of stack registers used by the current function.
+ *     Optimisation passes may allocate further stack registers.
+ *
+ * nauto
+ *     the number of automatic variables of the current function.
+ *     Optimisation passes may move automatic variables to stack
+ *     registers and renumber the remaining ones.
+ */
+enum {
+	LABEL = 010000,
+	WORD = 020000,
+	RUNTIME = 030000,
+};
+
+struct ins {
+	unsigned short op;
+	struct expr e;
+};
+
+extern struct ins ir[IRSIZ];
+extern unsigned short nir;
+extern unsigned char stacksize, nauto;
+
+/*
+ * isskip(op)
+ *     Return 1 if op is an instruction that may skip the next one.
+ *
+ * blockend(i)
+ *     Return the index of the first instruction after the end of the
+ *     basic block beginning at index i.
+ */
+extern int isskip(int);
+extern int blockend(int);
+
+/*
+ * Run the optimisation passes over the intermediate representation of
+ * the current function.  Afterwards, ndead holds the number of words
+ * removed as dead code and njump the number of jumps removed by jump
+ * threading.
+ */
+extern void optimise(void);
+extern unsigned short ndead, njump;
+
+/*
+ * Once the function has been optimised, remove the code setting stack
+ * registers to constants on entry if loading them with the frame
+ * template is cheaper.  The registers are renumbered such that the
+ * first ninit stack registers are preloaded with the values in
+ * stackinit.
+ */
+extern void preload(void);
+extern unsigned short stackinit[];
+extern unsigned char ninit;
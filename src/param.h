@@ -8,7 +8,16 @@
  * 0020--0027 runtime registers
  * 0030--0177 scratch registers
  *
- * all scratch registers must be preserved by the callee.
+ * all scratch registers must be preserved by the callee.  The topmost
+ * scratch registers hold the pointer pool shared by all functions,
+ * which never reaches into the frame of any function.
+ * Below it, the topmost scratch registers not used by any function hold
+ * pointers to the specialised prologue and epilogue routines (see
+ * codegen.c).
+ *
+ * the indexed memory locations 0010 and 0011 are used by the runtime.
+ * 0012--0017 are used by the optimiser as auto-index registers in
+ * loops without calls to B functions and need not be preserved.
  *
  * the runtime registers are used as follows:
  * 0020 pointer to the ENTER routine
@@ -20,8 +29,11 @@
  */
 enum {
 	NZEROPAGE = 00200,			/* number of storage locations in the zero page */
+	MINAUTOINDEX = 00012,			/* the first auto-index register available */
+	NAUTOINDEX = 00020 - MINAUTOINDEX,	/* number of auto-index registers available */
 	MINSCRATCH = 00030,			/* the first scratch register */
 	NSCRATCH = NZEROPAGE - MINSCRATCH,	/* number of scratch registers */
+	MAXPOOL = 00040,			/* maximum number of pool registers */
 };
 
 /* table sizes */
@@ -30,12 +42,22 @@ enum {
 	DECLSIZ = 00040,			/* declaration table size */
 	DATASIZ = 01000,			/* data area size */
 	ARGSIZ  = 00040,			/* maximum number of arguments in parser */
+	INLSIZ  = 01000,			/* inline table size */
+	IRSIZ   = 04000,			/* maximum number of instructions in a function */
+	CASESIZ = 00400,			/* maximum number of cases in nested switches */
+	SWITCHSIZ = 00020,			/* maximum nesting depth of switches */
+	SPILLSIZ = 00400,			/* number of templated values remembered for the pool */
 };
 
 /* various parameters */
 enum {
 	MAXERRORS = 10,				/* number of errors before the compiler gives up */
 	MAXNAME = 8,				/* maximum name size */
+	MAXSTUB = 4,				/* maximum number of specialised frame shapes */
+	MAXALIAS = 4,				/* maximum number of aliases of AC */
+	STUBSIZ = 00060,			/* maximum size of a specialised prologue */
+	MAXINLINE = 00010,			/* maximum size of a function expanded inline */
+	LOOPITER = 4,				/* iterations assumed for a loop when estimating costs */
 };
 
 #define NAMEFMT "%.8s"				/* format string to print a name */
@@ -3,6 +3,7 @@
 
 %{
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "param.h"
@@ -27,9 +28,38 @@ static char narg = 0;
  */
 static struct expr breaklabel = { NOBREAK, "(BREAK)" };
 
+/*
+ * The switch statements being parsed.  The cases of all of them are
+ * collected in cases, those of switches[i] beginning at index
+ * switches[i].base.  The code dispatching to the cases is emitted
+ * after the body at label dispatch.
+ */
+static struct swtch {
+	struct expr dispatch, dflt;
+	unsigned short base;
+} switches[SWITCHSIZ];
+
+static struct swcase {
+	struct expr label;
+	unsigned short value;
+} cases[CASESIZ];
+
+static unsigned char nswitch = 0;
+static unsigned short ncase = 0;
+
 static void argpush(struct expr *);
-static void docall(struct expr *, int);
+static void docall(struct expr *, struct expr *, int);
+static void beginswitch(void);
+static void docase(struct expr *);
+static void dodefault(void);
+static void endswitch(struct expr *);
+static void setconst(struct expr *, int);
+static int simplify(struct expr *, struct expr *, struct expr *, int, int);
+static void doadd(struct expr *, struct expr *, struct expr *, int);
+static void dosub(struct expr *, struct expr *, struct expr *, int);
+static void doand(struct expr *, struct expr *, struct expr *, int);
 static void docmp(struct expr *, struct expr *, struct expr *, int, int);
+static void domul(struct expr *, struct expr *, struct expr *, int);
 static void door(struct expr *, struct expr *, struct expr *, int, int);
 static void doshift(struct expr *, struct expr *, struct expr *, int, int);
 
@@ -183,20 +213,13 @@ statement	: AUTO auto_list ';' statement
 		| EXTRN extrn_list ';' statement
 		| label ':' statement
 		| '[' statement_list ']'
-		| IF if_control statement %prec ELSE {
-			ldconst(0);
-			putlabel(&$2);
-		}
+		| IF if_control statement %prec ELSE { putfwdlabel(&$2); }
 		| IF if_control statement ELSE {
 			memset($$.name, 0, MAXNAME);
 			newlabel(&$$);
-			ldconst(0);
 			jmp(&$$);
-			putlabel(&$2);
-		} statement {
-			ldconst(0);
-			putlabel(&$5);
-		}
+			putfwdlabel(&$2);
+		} statement { putfwdlabel(&$5); }
 		| WHILE {
 			memset($$.name, 0, MAXNAME);
 			newlabel(&$$);
@@ -208,12 +231,30 @@ statement	: AUTO auto_list ';' statement
 		} statement {
 			ldconst(0);
 			jmp(&$2);
-			putlabel(&$3);
+			putfwdlabel(&$3);
 			breaklabel = $4;
 		}
-		| SWITCH '(' expr ')' statement	{ /* original: SWITCH expr statement */
+		| SWITCH '(' expr ')' { /* original: SWITCH expr statement */
+			/* keep the value around for the dispatch code */
+			if (class($3.value) == LSTACK || class($3.value) == LVALUE) {
+				lda(&$3);
+				pop(&$3);
+				push(&$3);
+			}
+
+			beginswitch();
+			ldconst(0);
+			jmp(&switches[nswitch - 1].dispatch);
+
+			$$ = breaklabel;
+			memset(breaklabel.name, 0, MAXNAME);
+			newlabel(&breaklabel);
+		} statement {
+			jmp(&breaklabel);
+			endswitch(&$3);
 			pop(&$3);
-			error("SWITCH", "not implemented");
+			putfwdlabel(&breaklabel);
+			breaklabel = $5;
 		}
 		| GOTO expr ';' {
 			ldconst(0);
@@ -229,10 +270,8 @@ statement	: AUTO auto_list ';' statement
 		| BREAK ';' {
 			if (breaklabel.value == NOBREAK)
 				error("BREAK", "no loop to break");
-			else {
-				ldconst(0);
+			else
 				jmp(&breaklabel);
-			}
 		}
 		| expr ';' { pop(&$1); }
 		| ';'
@@ -261,8 +300,8 @@ label		: NAME {
 			ldconst(0);
 			putlabel(e);
 		}
-		| CASE CONSTANT { error("CASE", "not implemented"); }
-		| DEFAULT { error("DEFAULT", "not implemented"); }
+		| CASE CONSTANT { docase(&$2); }
+		| DEFAULT { dodefault(); }
 		;
 
 statement_list	: /* empty */
@@ -322,10 +361,7 @@ expr		: NAME {
 		}
 		| CONSTANT /* default action */
 		| '(' expr ')' { $$ = $2; }
-		| expr '(' arguments ')' {
-			jms(&$1);
-			docall(&$$, $3.value);
-		}
+		| expr '(' arguments ')' { docall(&$$, &$1, $3.value); }
 		| expr '[' expr ']' {
 			if (inac($3.value)) {
 				lda(&$3);
@@ -339,7 +375,7 @@ expr		: NAME {
 				pop(&$3);
 			}
 
-			push(&$$);
+			forcepush(&$$);
 			$$ = r2lval(&$$);
 		}
 		| expr INC {
@@ -371,10 +407,14 @@ expr		: NAME {
 		}
 		| '+' expr %prec INC { $$ = $2; }
 		| '-' expr %prec INC {
-			lda(&$2);
-			pop(&$2);
-			opr(CIA);
-			push(&$$);
+			if (isconst($2.value))
+				setconst(&$$, -val($2.value));
+			else {
+				lda(&$2);
+				pop(&$2);
+				opr(CIA);
+				push(&$$);
+			}
 		}
 		| '*' expr %prec INC {
 			/* perform a load to get an rvalue if needed */
@@ -392,118 +432,36 @@ expr		: NAME {
 				error($2.name, "not an lvalue");
 		}
 		| '^' expr %prec INC {
-			lda(&$2);
-			pop(&$2);
-			opr(CMA);
-			push(&$$);
-		}
-		| '!' expr {
-			lda(&$2);
-			pop(&$2);
-			opr(SNA | CLA);
-			opr(CLA | IAC);
-			push(&$$);
-		}
-		| expr '*' expr {
-			if (inac($3.value)) {
-				lda(&$3);
-				pop(&$3);
-				dca(&factor);
-				lda(&$1);
-				pop(&$1);
-			} else {
-				lda(&$1);
-				pop(&$1);
-				dca(&factor);
-				lda(&$3);
-				pop(&$3);
+			if (isconst($2.value))
+				setconst(&$$, ~val($2.value));
+			else {
+				lda(&$2);
+				pop(&$2);
+				opr(CMA);
+				push(&$$);
 			}
-			acrandom();
-			instr("MUL");
-			push(&$$);
 		}
-		| expr ASMUL expr {
-			if (inac($3.value)) {
-				lda(&$3);
-				pop(&$3);
-				dca(&factor);
-				lda(&$1);
-			} else {
-				lda(&$1);
-				dca(&factor);
-				lda(&$3);
-				pop(&$3);
+		| '!' expr {
+			if (isconst($2.value))
+				setconst(&$$, val($2.value) == 0);
+			else {
+				lda(&$2);
+				pop(&$2);
+				opr(SNA | CLA);
+				opr(CLA | IAC);
+				push(&$$);
 			}
-			acrandom();
-			instr("MUL");
-			dca(&$1);
-			$$ = $1;
 		}
+		| expr '*' expr { domul(&$$, &$1, &$3, 0); }
+		| expr ASMUL expr { domul(&$$, &$1, &$3, 1); }
 		| expr '%' expr /* TODO */
 		| expr ASMOD expr /* TODO */
 		| expr '/' expr /* TODO */
 		| expr ASDIV expr /* TODO */
-		| expr '+' expr {
-			if (inac($3.value)) {
-				lda(&$3);
-				pop(&$3);
-				tad(&$1);
-				pop(&$1);
-			} else {
-				lda(&$1);
-				pop(&$1);
-				tad(&$3);
-				pop(&$3);
-			}
-
-			push(&$$);
-		}
-		| expr ASADD expr {
-			if (inac($3.value)) {
-				lda(&$3);
-				pop(&$3);
-				tad(&$1);
-			} else {
-				lda(&$1);
-				tad(&$3);
-				pop(&$3);
-			}
-			dca(&$1);
-			$$ = $1;
-		}
-		| expr '-' expr {
-			if (inac($1.value) && isconst($3.value)) {
-				$3.value = -val($3.value) & 07777;
-				lda(&$1);
-				pop(&$1);
-				tad(&$3);
-				pop(&$3);
-			} else {
-				lda(&$3);
-				pop(&$3);
-				opr(CIA);
-				tad(&$1);
-				pop(&$1);
-			}
-
-			push(&$$);
-		}
-		| expr ASSUB expr {
-			if (inac($1.value) && isconst($3.value)) {
-				$3.value = -val($3.value) & 07777;
-				lda(&$1);
-				tad(&$3);
-				pop(&$3);
-			} else {
-				lda(&$3);
-				pop(&$3);
-				opr(CIA);
-				tad(&$1);
-			}
-
-			dca(&$1);
-			$$ = $1;
-		}
+		| expr '+' expr { doadd(&$$, &$1, &$3, 0); }
+		| expr ASADD expr { doadd(&$$, &$1, &$3, 1); }
+		| expr '-' expr { dosub(&$$, &$1, &$3, 0); }
+		| expr ASSUB expr { dosub(&$$, &$1, &$3, 1); }
 		| expr SHL expr { doshift(&$$, &$1, &$3, RAL, 0); }
 		| expr ASSHL expr { doshift(&$$, &$1, &$3, RAL, 1); }
 		| expr SHR expr { doshift(&$$, &$1, &$3, RAR, 0); }
@@ -520,50 +478,31 @@ expr		: NAME {
 		| expr ASEQ expr { docmp(&$$, &$1, &$3, SNA, 1); }
 		| expr NE expr { docmp(&$$, &$1, &$3, SZA, 0); }
 		| expr ASNE expr { docmp(&$$, &$1, &$3, SZA, 1); }
-		| expr '&' expr {
-			if (inac($3.value)) {
-				lda(&$3);
-				pop(&$3);
-				and(&$1);
-				pop(&$1);
-			} else {
-				lda(&$1);
-				pop(&$1);
-				and(&$3);
-				pop(&$3);
-			}
-
-			push(&$$);
-		}
-		| expr ASAND expr {
-			if (inac($3.value)) {
-				lda(&$3);
-				pop(&$3);
-				and(&$1);
-			} else  {
-				lda(&$1);
-				and(&$3);
-				pop(&$3);
-			}
-
-			dca(&$1);
-			$$ = $1;
-		}
+		| expr '&' expr { doand(&$$, &$1, &$3, 0); }
+		| expr ASAND expr { doand(&$$, &$1, &$3, 1); }
 		| expr '^' expr { door(&$$, &$1, &$3, CMA | STL | RAL | IAC, 0); }
 		| expr ASXOR expr { door(&$$, &$1, &$3, CMA | STL | RAL | IAC, 1); }
 		| expr '\\' expr { door(&$$, &$1, &$3, CIA, 0); }
 		| expr ASOR expr { door(&$$, &$1, &$3, CIA, 1); }
 		| expr '?' expr ':' expr {
-			opr(STA | CLL);
-			tad(&$1); /* L = $1 != 0 */
-			pop(&$1);
-			opr(SNL | CLA);
-			tad(&$5); /* won't set L */
-			pop(&$5);
-			opr(SZL); /* L is only set if $1 == 0 */
-			tad(&$3);
-			pop(&$3);
-			push(&$$);
+			/* both $3 and $5 have been evaluated already */
+			if (isconst($1.value) && val($1.value) != 0) {
+				pop(&$5);
+				$$ = $3;
+			} else if (isconst($1.value) && !onstack($3.value))
+				$$ = $5;
+			else {
+				opr(STA | CLL);
+				tad(&$1); /* L = $1 != 0 */
+				pop(&$1);
+				opr(SNL | CLA);
+				tad(&$5); /* won't set L */
+				pop(&$5);
+				opr(SZL); /* L is only set if $1 == 0 */
+				tad(&$3);
+				pop(&$3);
+				push(&$$);
+			}
 		}
 		| expr '=' expr {
 			lda(&$3);
@@ -596,16 +535,15 @@ argpush(struct expr *e)
 }
 
 /*
- * Emit a function call with argc arguments and store the return
- * value in e.  The JMS instruction is not emitted.
+ * Emit a call to function fun with argc arguments and store the return
+ * value in q.
  */
-static void docall(struct expr *q, int argc)
+static void docall(struct expr *q, struct expr *fun, int argc)
 {
-	int i, arg0;
+	int arg0;
 
 	arg0 = narg - argc;
-	for (i = 0; i < argc; i++)
-		emitl(&argstack[arg0 + i]);
+	emitcall(fun, argstack + arg0, argc);
 
 	while (narg > arg0)
 		pop(argstack + (int)--narg);
@@ -613,6 +551,602 @@ static void docall(struct expr *q, int argc)
 	push(q);
 }
 
+/*
+ * Begin a new switch statement.
+ */
+static void
+beginswitch(void)
+{
+	struct swtch *sw;
+
+	if (nswitch >= SWITCHSIZ)
+		fatal("SWITCH", "switches nested too deeply");
+
+	sw = switches + nswitch++;
+	memset(sw->dispatch.name, 0, MAXNAME);
+	newlabel(&sw->dispatch);
+	memset(sw->dflt.name, 0, MAXNAME);
+	sw->dflt.value = NODEFAULT;
+	sw->base = ncase;
+}
+
+/*
+ * Place a case label for constant c in the innermost switch.
+ */
+static void
+docase(struct expr *c)
+{
+	struct swcase *sc;
+	int i;
+
+	if (nswitch == 0) {
+		error("CASE", "not in a switch");
+		return;
+	}
+
+	if (!isconst(c->value)) {
+		error("CASE", "not a constant");
+		return;
+	}
+
+	for (i = switches[nswitch - 1].base; i < ncase; i++)
+		if (cases[i].value == val(c->value)) {
+			error("CASE", "duplicate case %04o", val(c->value));
+			return;
+		}
+
+	if (ncase >= CASESIZ)
+		fatal("CASE", "too many cases");
+
+	sc = cases + ncase++;
+	sc->value = val(c->value);
+	memset(sc->label.name, 0, MAXNAME);
+	newlabel(&sc->label);
+	ldconst(0);
+	putlabel(&sc->label);
+}
+
+/*
+ * Place the default label of the innermost switch.
+ */
+static void
+dodefault(void)
+{
+	struct swtch *sw;
+
+	if (nswitch == 0) {
+		error("DEFAULT", "not in a switch");
+		return;
+	}
+
+	sw = switches + nswitch - 1;
+	if (sw->dflt.value != NODEFAULT) {
+		error("DEFAULT", "duplicate default");
+		return;
+	}
+
+	newlabel(&sw->dflt);
+	ldconst(0);
+	putlabel(&sw->dflt);
+}
+
+static int
+casecmp(const void *a, const void *b)
+{
+	const struct swcase *ca = a, *cb = b;
+
+	return ((int)ca->value - (int)cb->value);
+}
+
+/*
+ * Switches with up to CHAINMAX cases and the leaves of a binary search
+ * are dispatched by comparing with each case in turn.  Jump tables are
+ * only considered if at least one in TABLEDENS entries is a case, i.e.
+ * if the range of case values is at most TABLEDENS times the number of
+ * cases.  Up to two thirds of the entries may lead to the default.
+ */
+enum {
+	CHAINMAX = 3,
+	TABLEDENS = 3,	/* range <= TABLEDENS * number of cases */
+};
+
+/*
+ * Cost of testing v against the n cases at c in turn.  The time is
+ * averaged over the cases and the default.
+ */
+static struct cost
+chaincost(const struct expr *v, const struct swcase *c, int n)
+{
+	struct expr k = { RCONST, "" };
+	struct cost test = { 0, 0 }, total;
+	int i;
+
+	total = isncost(TAD, v);
+	for (i = 0; i < n; i++) {
+		k.value = RCONST | (i > 0 ? c[i - 1].value : 0) - c[i].value & 07777;
+		addcost(&test, isncost(TAD, &k));
+		addcost(&test, isncost(SNA, NULL));
+		addcost(&test, isncost(JMP, &c[i].label));
+	}
+
+	total.words += test.words + 2;
+	total.time += test.time / 2 + isncost(JMP, &c[0].label).time;
+
+	return (total);
+}
+
+/*
+ * Cost of a binary search for v among the n sorted cases at c.  Each
+ * node compares v with the middle case, jumps there if equal, and
+ * otherwise continues with the cases below or above.
+ */
+static struct cost
+searchcost(const struct expr *v, const struct swcase *c, int n)
+{
+	struct expr k = { RCONST, "" };
+	struct cost node, lo, hi;
+	int mid;
+
+	if (n <= CHAINMAX)
+		return (chaincost(v, c, n));
+
+	mid = n / 2;
+	k.value = RCONST | -c[mid].value & 07777;
+	node = isncost(TAD, v);
+	addcost(&node, isncost(CLL, NULL));
+	addcost(&node, isncost(TAD, &k));
+	addcost(&node, isncost(SNA, NULL));
+	addcost(&node, isncost(JMP, &c[mid].label));
+	addcost(&node, isncost(SNL | CLA, NULL));
+	addcost(&node, isncost(JMP, &c[mid].label));
+
+	lo = searchcost(v, c, mid);
+	hi = searchcost(v, c + mid + 1, n - mid - 1);
+	node.words += lo.words + hi.words;
+	node.time += (lo.time * mid + hi.time * (n - mid - 1)) / n;
+
+	return (node);
+}
+
+/*
+ * Cost of a jump table for v spanning range entries.
+ */
+static struct cost
+tablecost(const struct expr *v, int range)
+{
+	struct expr k = { RCONST | 0200, "" }, r = { RSTACK, "" };
+	struct cost c;
+
+	c = isncost(TAD, v);
+	addcost(&c, isncost(TAD, &k));
+	addcost(&c, isncost(DCA, &r));
+	addcost(&c, isncost(CLL, NULL));
+	addcost(&c, isncost(TAD, &r));
+	addcost(&c, isncost(TAD, &k));
+	addcost(&c, isncost(SZL | CLA, NULL));
+	addcost(&c, isncost(TAD, &r));
+	addcost(&c, isncost(TAD, &k));
+	addcost(&c, isncost(DCA, &r));
+	r.value = LSTACK;
+	addcost(&c, isncost(TAD, &r));
+	r.value = RSTACK;
+	addcost(&c, isncost(DCA, &r));
+	r.value = LSTACK;
+	addcost(&c, isncost(JMP, &r));
+	c.words += 1 + range;
+
+	return (c);
+}
+
+/*
+ * Jump to the case among the n cases at c that v is equal to, or to
+ * dflt if there is none, by comparing v with each case in turn.  As
+ * each label is reached with AC clear, the difference of v and the
+ * case is kept in AC.
+ */
+static void
+chain(struct expr *v, const struct swcase *c, int n, const struct expr *dflt)
+{
+	struct expr k = { RCONST, "" };
+	int i;
+
+	lda(v);
+	for (i = 0; i < n; i++) {
+		k.value = RCONST | (i > 0 ? c[i - 1].value : 0) - c[i].value & 07777;
+		tad(&k);
+		opr(SNA);
+		jmp(&c[i].label);
+	}
+
+	ldconst(0);
+	jmp(dflt);
+}
+
+/*
+ * Jump to the case among the n sorted cases at c that v is equal to,
+ * or to dflt if there is none, by binary search.  As AC is clear
+ * before the CLL, L is set by adding the negated case if v is not
+ * below it.
+ */
+static void
+search(struct expr *v, const struct swcase *c, int n, const struct expr *dflt)
+{
+	struct expr k = { RCONST, "" }, below = { 0, "" };
+	int mid;
+
+	if (n <= CHAINMAX) {
+		chain(v, c, n, dflt);
+		return;
+	}
+
+	mid = n / 2;
+	newlabel(&below);
+	k.value = RCONST | -c[mid].value & 07777;
+	lda(v);
+	opr(CLL);
+	tad(&k);
+	opr(SNA);
+	jmp(&c[mid].label);
+	opr(SNL | CLA);
+	jmp(&below);
+	search(v, c + mid + 1, n - mid - 1, dflt);
+	putfwdlabel(&below);
+	search(v, c, mid, dflt);
+}
+
+/*
+ * Jump to the case among the n sorted cases at c that v is equal to,
+ * or to dflt if there is none, through a table of case labels.  The
+ * index into the table is compared with the table size to catch
+ * values out of range.
+ */
+static void
+table(struct expr *v, const struct swcase *c, int n, const struct expr *dflt)
+{
+	struct expr k = { RCONST, "" }, tbl = { 0, "" }, p, e;
+	int i, j, range;
+
+	range = c[n - 1].value - c[0].value + 1;
+	newlabel(&tbl);
+
+	/* p = v - min */
+	lda(v);
+	k.value = RCONST | -c[0].value & 07777;
+	tad(&k);
+	forcepush(&p);
+
+	/* if (p >= range) goto dflt */
+	ldconst(0);
+	opr(CLL);
+	tad(&p);
+	k.value = RCONST | -range & 07777;
+	tad(&k);
+	opr(SZL | CLA);
+	jmp(dflt);
+
+	/* goto *(tbl + p) */
+	lda(&p);
+	pop(&p);
+	tbl.value = RLABEL | val(tbl.value);
+	tad(&tbl);
+	forcepush(&p);
+	e = r2lval(&p);
+	lda(&e);
+	pop(&e);
+	forcepush(&p);
+	e = r2lval(&p);
+	ldconst(0);
+	if (range > n)
+		joinjump(dflt);
+
+	jmp(&e);
+	pop(&e);
+
+	tbl.value = LLABEL | val(tbl.value);
+	putlabel(&tbl);
+	for (i = j = 0; i < range; i++)
+		if (c[j].value == c[0].value + i)
+			emitl(&c[j++].label);
+		else
+			emitl(dflt);
+}
+
+/*
+ * End the innermost switch, dispatching on value v.  If v is
+ * constant, jump to the matching case right away.  Otherwise, the
+ * cheapest of a chain of comparisons, a binary search, and a jump
+ * table is used.
+ */
+static void
+endswitch(struct expr *v)
+{
+	struct swtch *sw;
+	struct swcase *c;
+	struct expr dflt;
+	struct cost cchain, csearch, ctable;
+	int i, n, range;
+
+	sw = switches + --nswitch;
+	c = cases + sw->base;
+	n = ncase - sw->base;
+	ncase = sw->base;
+	dflt = sw->dflt.value == NODEFAULT ? breaklabel : sw->dflt;
+
+	ldconst(0);
+	putlabel(&sw->dispatch);
+
+	if (isconst(v->value)) {
+		for (i = 0; i < n; i++)
+			if (c[i].value == val(v->value))
+				break;
+
+		jmp(i < n ? &c[i].label : &dflt);
+		return;
+	}
+
+	if (n == 0) {
+		jmp(&dflt);
+		return;
+	}
+
+	qsort(c, n, sizeof *c, casecmp);
+	range = c[n - 1].value - c[0].value + 1;
+
+	cchain = chaincost(v, c, n);
+	csearch = searchcost(v, c, n);
+	if (range <= TABLEDENS * n) {
+		ctable = tablecost(v, range);
+		if (cheaper(ctable, cchain) && cheaper(ctable, csearch)) {
+			table(v, c, n, &dflt);
+			return;
+		}
+	}
+
+	if (cheaper(cchain, csearch))
+		chain(v, c, n, &dflt);
+	else
+		search(v, c, n, &dflt);
+}
+
+/*
+ * Set q to the constant v.
+ */
+static void
+setconst(struct expr *q, int v)
+{
+	memset(q->name, 0, MAXNAME);
+	q->value = RCONST | v & 07777;
+}
+
+/*
+ * Try to compute the result of applying the binary operator op to a
+ * and b at compile time, either because both are constant or through
+ * an algebraic identity such as x + 0 = x, x * 0 = 0, or x - x = 0.
+ * op is the operator's token.  If as is set, a is to be assigned the
+ * result and only identities leaving a unchanged are applied.  On
+ * success, pop what needs to be popped, store the result to q, and
+ * return 1.  Otherwise, return 0.
+ *
+ * As both operands have already been evaluated, dropping one of them
+ * does not lose any side effects.
+ */
+static int
+simplify(struct expr *q, struct expr *a, struct expr *b, int op, int as)
+{
+	int x, y, v, id, zero, all;
+
+	x = val(a->value);
+	y = val(b->value);
+
+	if (isconst(a->value) && isconst(b->value) && !as) {
+		switch (op) {
+		case '+': v = x + y; break;
+		case '-': v = x - y; break;
+		case '*': v = x * y; break;
+		case '&': v = x & y; break;
+		case '^': v = x ^ y; break;
+		case '\\': v = x | y; break;
+		case SHL: v = y < 12 ? x << y : 0; break;
+		case SHR: v = y < 12 ? x >> y : 0; break;
+		default:
+			return (0);
+		}
+
+		setconst(q, v);
+		return (1);
+	}
+
+	/* identity element of op */
+	switch (op) {
+	case '*': id = 1; break;
+	case '&': id = 07777; break;
+	default: id = 0;
+	}
+
+	/* x op id = x */
+	if (isconst(b->value) && y == id) {
+		pop(b);
+		*q = *a;
+		return (1);
+	}
+
+	if (as)
+		return (0);
+
+	/* id op x = x for commutative op */
+	if (isconst(a->value) && x == id && op != '-' && op != SHL && op != SHR) {
+		*q = *b;
+		return (1);
+	}
+
+	/* x op zero = zero and zero op x = zero */
+	zero = op == '*' || op == '&' ? 0 : op == '\\' ? 07777 : -1;
+	all = op == SHL || op == SHR;
+	if (zero >= 0 && (isconst(b->value) && y == zero || isconst(a->value) && x == zero)
+	    || all && isconst(a->value) && x == 0) {
+		pop(b);
+		pop(a);
+		setconst(q, all ? 0 : zero);
+		return (1);
+	}
+
+	/* x - x = 0 and x ^ x = 0 */
+	if ((op == '-' || op == '^') && a->value == b->value) {
+		pop(b);
+		pop(a);
+		setconst(q, 0);
+		return (1);
+	}
+
+	return (0);
+}
+
+/*
+ * Return 1 if b is to be loaded before a when computing a op b for a
+ * commutative op.  This is the case if b is in AC already or if b is
+ * on the stack above a, as the stack is popped in reverse order.
+ */
+static int
+bfirst(const struct expr *a, const struct expr *b)
+{
+	if (inac(b->value))
+		return (1);
+
+	if (inac(a->value) || !onstack(b->value))
+		return (0);
+
+	return (!onstack(a->value) || val(a->value) < val(b->value));
+}
+
+/*
+ * Add a and b.  If as is clear, pop both a and b and store the result
+ * to q.  Otherwise deposit the result in a, pop b, and copy a to q.
+ */
+static void
+doadd(struct expr *q, struct expr *a, struct expr *b, int as)
+{
+	if (simplify(q, a, b, '+', as))
+		return;
+
+	if (bfirst(a, b)) {
+		lda(b);
+		pop(b);
+		tad(a);
+		if (!as)
+			pop(a);
+	} else {
+		lda(a);
+		if (!as)
+			pop(a);
+		tad(b);
+		pop(b);
+	}
+
+	if (as) {
+		dca(a);
+		*q = *a;
+	} else
+		push(q);
+}
+
+/*
+ * Subtract b from a.  If as is clear, pop both a and b and store the
+ * result to q.  Otherwise deposit the result in a, pop b, and copy a
+ * to q.
+ */
+static void
+dosub(struct expr *q, struct expr *a, struct expr *b, int as)
+{
+	if (simplify(q, a, b, '-', as))
+		return;
+
+	if (inac(a->value) && isconst(b->value)) {
+		b->value = -val(b->value) & 07777;
+		lda(a);
+		if (!as)
+			pop(a);
+		tad(b);
+		pop(b);
+	} else {
+		lda(b);
+		pop(b);
+		opr(CIA);
+		tad(a);
+		if (!as)
+			pop(a);
+	}
+
+	if (as) {
+		dca(a);
+		*q = *a;
+	} else
+		push(q);
+}
+
+/*
+ * Compute the bitwise and of a and b.  If as is clear, pop both a and
+ * b and store the result to q.  Otherwise deposit the result in a, pop
+ * b, and copy a to q.
+ */
+static void
+doand(struct expr *q, struct expr *a, struct expr *b, int as)
+{
+	if (simplify(q, a, b, '&', as))
+		return;
+
+	if (bfirst(a, b)) {
+		lda(b);
+		pop(b);
+		and(a);
+		if (!as)
+			pop(a);
+	} else {
+		lda(a);
+		if (!as)
+			pop(a);
+		and(b);
+		pop(b);
+	}
+
+	if (as) {
+		dca(a);
+		*q = *a;
+	} else
+		push(q);
+}
+
+/*
+ * Return 1 if the group 2 skip instruction p skips with AC and L
+ * holding ac and l.
+ */
+static int
+skips(int p, int ac, int l)
+{
+	int skip;
+
+	if (p & 00010) {
+		/* SPA, SNA, SZL: skip if all conditions hold */
+		skip = 1;
+		if (p & 00100 && ac & 04000)
+			skip = 0;
+		if (p & 00040 && ac == 0)
+			skip = 0;
+		if (p & 00020 && l)
+			skip = 0;
+	} else {
+		/* SMA, SZA, SNL: skip if any condition holds */
+		skip = 0;
+		if (p & 00100 && ac & 04000)
+			skip = 1;
+		if (p & 00040 && ac == 0)
+			skip = 1;
+		if (p & 00020 && l)
+			skip = 1;
+	}
+
+	return (skip);
+}
+
 /*
  * Perform a comparison of a and b by predicate p.  If as is clear,
  * push the result to q and pop both a and b.  Otherwise deposit the
@@ -621,13 +1155,49 @@ static void docall(struct expr *q, int argc)
 static void
 docmp(struct expr *q, struct expr *a, struct expr *b, int p, int as)
 {
-	lda(b);
-	pop(b);
-	/* only set up L if we have SZL or SNL */
-	opr(p & 00020 ? CIA | STL : CIA);
-	tad(a);
-	if (!as)
+	int x, y, l;
+
+	/*
+	 * Compute the result at compile time if it is known by
+	 * simulating the code below.
+	 */
+	if (!as && (isconst(a->value) && isconst(b->value) || a->value == b->value)) {
+		x = isconst(a->value) ? val(a->value) : 0;
+		y = isconst(b->value) ? val(b->value) : 0;
+
+		/* STL; CIA */
+		y = (~y & 07777) + 1;
+		l = 1 ^ y >> 12;
+		y &= 07777;
+
+		/* TAD a */
+		x += y;
+		l ^= x >> 12;
+		x &= 07777;
+
+		pop(b);
 		pop(a);
+		setconst(q, !skips(p, x, l));
+		return;
+	}
+
+	/* a == b and a != b can be computed as b - a, too */
+	if (!as && (p == SNA || p == SZA) && inac(a->value) && !onstack(b->value)) {
+		lda(a);
+		pop(a);
+		opr(CIA);
+		tad(b);
+		pop(b);
+	} else {
+		lda(b);
+		pop(b);
+		/* only set up L if we have SZL or SNL */
+		opr(p & 00020 ? CIA | STL : CIA);
+		tad(a);
+		if (!as)
+			pop(a);
+	}
+
 	opr(p | CLA);
 	opr(CLA | IAC);
 	if (as) {
@@ -637,6 +1207,132 @@ docmp(struct expr *q, struct expr *a, struct expr *b, int p, int as)
 		push(q);
 }
 
+/*
+ * Return the cost of computing x * v by shifting and adding, that is,
+ * by loading x, then shifting once for each further bit of v and
+ * adding x for each further bit set.  v must not be zero.
+ */
+static struct cost
+shiftaddcost(const struct expr *x, int v)
+{
+	struct cost c = { 0, 0 };
+
+	addcost(&c, isncost(CLA, NULL));
+	addcost(&c, isncost(TAD, x));
+	for (v &= 07777; v > 1; v >>= 1) {
+		addcost(&c, isncost(CLL | RAL, NULL));
+		if (v & 1)
+			addcost(&c, isncost(TAD, x));
+	}
+
+	return (c);
+}
+
+/*
+ * Compute x * v by shifting and adding.  As x is added to the product
+ * repeatedly, it must be in memory.
+ */
+static void
+shiftadd(const struct expr *x, int v)
+{
+	int i;
+
+	catchup();
+	lda(x);
+	for (i = 10; i >= 0; i--)
+		if (v >> i + 1 != 0) {
+			opr(CLL | RAL);
+			if (v >> i & 1)
+				tad(x);
+		}
+}
+
+/*
+ * Multiply a and b.  If as is clear, pop both a and b and store the
+ * result to q.  If as is set, pop only b, store the result to a and
+ * copy a to q.
+ *
+ * If one factor is a constant, the product can be computed by shifting
+ * and adding the other factor, or the negation of the product with the
+ * negated constant.  Whatever is cheapest among these and a call to
+ * MUL is used.  MUL shifts out the factor in factor one bit at a time,
+ * taking 17 memory cycles for each bit and 2 more for each bit set.
+ * Thus the constant is placed there.
+ */
+static void
+domul(struct expr *q, struct expr *a, struct expr *b, int as)
+{
+	struct cost mul = { 1, 16 }; /* call and return */
+	struct expr *c, *x;
+	struct cost cmul, cpos, cneg;
+	int v;
+
+	if (simplify(q, a, b, '*', as))
+		return;
+
+	if (isconst(b->value)) {
+		c = b;
+		x = a;
+	} else if (!as && isconst(a->value)) {
+		c = a;
+		x = b;
+	} else
+		c = NULL;
+
+	if (c != NULL && val(c->value) != 0) {
+		cmul = isncost(CLA, NULL);
+		addcost(&cmul, isncost(TAD, c));
+		addcost(&cmul, isncost(DCA, &factor));
+		addcost(&cmul, isncost(CLA, NULL));
+		addcost(&cmul, isncost(TAD, x));
+		mul.time *= cpu->cycle;
+		addcost(&cmul, mul);
+		for (v = val(c->value); v != 0; v >>= 1)
+			cmul.time += (v & 1 ? 19 : 17) * cpu->cycle;
+
+		v = val(c->value);
+		cpos = shiftaddcost(x, v);
+		cneg = shiftaddcost(x, -v);
+		addcost(&cneg, isncost(CIA, NULL));
+
+		if (cheaper(cneg, cpos) && cheaper(cneg, cmul)) {
+			shiftadd(x, -v & 07777);
+			opr(CIA);
+			goto done;
+		} else if (cheaper(cpos, cmul)) {
+			shiftadd(x, v);
+			goto done;
+		}
+	}
+
+	/* the constant or the operand in AC goes to factor */
+	if (isconst(b->value) || bfirst(a, b) && !isconst(a->value)) {
+		lda(b);
+		pop(b);
+		dca(&factor);
+		lda(a);
+	} else {
+		lda(a);
+		if (!as)
+			pop(a);
+
+		dca(&factor);
+		lda(b);
+	}
+
+	acrandom();
+	emitrt("MUL");
+
+done:	pop(b);
+	if (as) {
+		dca(a);
+		*q = *a;
+	} else {
+		pop(a);
+		push(q);
+	}
+}
+
 /*
  * Perform a bitwise or or xor of a and b.  If as is clear, pop both
  * a and b and store the result to q.  If as is set, pop only a, store
@@ -649,6 +1345,9 @@ docmp(struct expr *q, struct expr *a, struct expr *b, int p, int as)
 static void
 door(struct expr *q, struct expr *a, struct expr *b, int op, int as)
 {
+	if (simplify(q, a, b, op == CIA ? '\\' : '^', as))
+		return;
+
 	/* compute $1 + $3 - ($1 & $3) */
 	lda(b);
 	and(a);
@@ -676,6 +1375,9 @@ door(struct expr *q, struct expr *a, struct expr *b, int op, int as)
 static void
 doshift(struct expr *q, struct expr *a, struct expr *b, int op, int as)
 {
+	if (simplify(q, a, b, op == RAL ? SHL : SHR, as))
+		return;
+
 	if (isconst(b->value)) {
 		static const unsigned short masks[2][11] = {
 			07777, 07777, 07770, 07760, 07740, 07700, 07600, 07400, 07000, 06000, 07777,
@@ -788,7 +1490,7 @@ doshift(struct expr *q, struct expr *a, struct expr *b, int op, int as)
 		lda(b);
 		pop(b);
 		opr(CMA);
-		push(&counter);
+		forcepush(&counter);
 		lda(a);
 		jmp(&end);
 		putlabel(&again);
@@ -20,14 +20,48 @@
  *     value of AC should not correspond to any expression, it is set
  *     to RANDOM.
  *
+ * aliases, nalias
+ *     The values of other expressions whose value should currently be
+ *     in AC, too.  nalias is 0 if acstate is RANDOM.
+ *
  * dirty
  *     This flag is 1 if dca(acstate) is deferred.  It is set by push(),
  *     cleared by pop(), writeback(), and acclear() and carefully
  *     managed by lda().
  */
 struct expr acstate = { RCONST | 0, "" };
+unsigned short aliases[MAXALIAS];
+unsigned char nalias = 0;
 static char dirty = 0;
 
+extern int
+inac(int v)
+{
+	int i;
+
+	if (acstate.value == v)
+		return (1);
+
+	for (i = 0; i < nalias; i++)
+		if (aliases[i] == v)
+			return (1);
+
+	return (0);
+}
+
+extern void
+addalias(int v)
+{
+	if (!isvalid(v) || inac(v))
+		return;
+
+	if (acstate.value == RANDOM) {
+		acstate.value = v;
+		memset(acstate.name, 0, MAXNAME);
+	} else if (nalias < MAXALIAS)
+		aliases[nalias++] = v;
+}
+
 /*
  * if dirty is set, write the content of AC to acstate and clear the
  * dirty flag.
@@ -35,28 +69,88 @@ static char dirty = 0;
 static void
 writeback(void)
 {
+	struct expr e;
+
+	/* isel() changes acstate */
 	if (dirty) {
-		isel(DCA, &acstate);
+		e = acstate;
+		isel(DCA, &e);
 		dirty = 0;
 	}
 }
 
+/*
+ * Like writeback(), but reload AC afterwards.  This is needed before
+ * instructions operating on the content of AC as lda() may have
+ * omitted the load of a value whose writeback is still pending.
+ */
+static void
+keepback(void)
+{
+	struct expr e;
+
+	if (dirty) {
+		e = acstate;
+		writeback();
+		isel(TAD, &e);
+	}
+}
+
 extern void
 forcepush(struct expr *e)
 {
+	int v;
+
 	writeback();
 	emitpush(e);
+
+	/* what was in AC still is */
+	v = acstate.value;
 	acstate = *e;
+	addalias(v);
 	dirty = 1;
 	lany();
 }
 
+/*
+ * Return 1 if push() may hand out v.  The parser may store to what
+ * push() returns, so v must be a memory location that is neither a
+ * stack register nor pointed to by one, as stack registers expire.
+ */
+static int
+pushable(int v)
+{
+	return (isvalid(v) && islval(v) && !onstack(v));
+}
+
 extern void
 push(struct expr *e)
 {
-	if (!inac(RANDOM) && !onstack(acstate.value))
+	struct expr a = { 0, "" };
+	struct cost c, best;
+	int i, found = 0;
+
+	if (pushable(acstate.value)) {
 		*e = acstate;
-	else
+		best = isncost(TAD, e);
+		found = 1;
+	}
+
+	/* an alias may be cheaper to refer to */
+	for (i = 0; i < nalias; i++) {
+		if (!pushable(aliases[i]))
+			continue;
+
+		a.value = aliases[i];
+		c = isncost(TAD, &a);
+		if (!found || cheaper(c, best)) {
+			*e = a;
+			best = c;
+			found = 1;
+		}
+	}
+
+	if (!found)
 		forcepush(e);
 }
 
@@ -64,7 +158,7 @@ extern void
 pop(struct expr *e)
 {
 	/* omit writeback on immediate pop */
-	if (inac(e->value))
+	if (acstate.value == e->value)
 		dirty = 0;
 
 	emitpop(e);
@@ -107,12 +201,13 @@ and(const struct expr *e)
 		return;
 	}
 
-	writeback();
-
-	if (e->value == (RCONST | 00000))
+	if (e->value == (RCONST | 00000)) {
+		writeback();
 		isel(CLA, NULL);
-	else
+	} else {
+		keepback();
 		isel(AND, e);
+	}
 }
 
 extern void
@@ -124,7 +219,7 @@ tad(const struct expr *e)
 		return;
 	}
 
-	writeback();
+	keepback();
 	isel(TAD, e);
 }
 
@@ -168,8 +263,11 @@ ldconst(int c)
 extern void
 lda(const struct expr *e)
 {
-	/* omit duplicate loads */
-	if (!inac(e->value)) {
+	/*
+	 * omit duplicate loads.  An alias cannot be reused while a
+	 * writeback is pending as the writeback clears AC.
+	 */
+	if (acstate.value != e->value && (dirty || !inac(e->value))) {
 		writeback();
 		isel(CLA, NULL);
 		isel(TAD, e);
@@ -182,8 +280,12 @@ extern void
 opr(int op)
 {
 	/* simplify case distinction */
-	if (op != NOP && op != OPR2)
+	if (op == NOP || op == OPR2)
+		;
+	else if ((op & (OPR2 | CLA)) == CLA)
 		writeback();
+	else
+		keepback();
 
 	isel(op, NULL);
 }
@@ -47,7 +47,6 @@ enum {
 /*
  * utility macros for dealing with storage classes.
  */
-#define inac(x) (acstate.value == (x))
 #define val(x) ((x) & ~CMASK)
 #define class(x) ((x) & CMASK)
 #define rclass(x) ((x) & CMASK & ~LMASK)
@@ -68,6 +67,7 @@ enum {
 	NOLVAL  = INVALID | 0000004, /* not an lvalue */
 	RANDOM  = INVALID | 0000005, /* unknown value */
 	NOBREAK	= INVALID | 0000006, /* no break label */
+	NODEFAULT = INVALID | 0000007, /* no default label */
 };
 
 /*
@@ -175,8 +175,11 @@ extern struct expr l2rval(const struct expr *);
  *
  * push(expr)
  *     Generate an expression referring to the content of AC.  This
- *     might involve allocating a new stack register for it.  The
- *     content of AC is preserved by this operation, but L is not.
+ *     is the cheapest memory location in AC not on the stack if there
+ *     is one, otherwise a new stack register is allocated for it.
+ *     Constants and addresses are never returned as the caller may
+ *     store to expr.  The content of AC is preserved by this
+ *     operation, but L is not.
  *
  * forcepush(expr)
  *     Same as push, but force a stack register to be allocated even if
@@ -193,11 +196,28 @@ extern struct expr l2rval(const struct expr *);
  * acstate
  *     The expression that is currently loaded into AC, if any.  If
  *     nothing is in AC, acstate.value is RANDOM.
+ *
+ * aliases, nalias
+ *     The values of further expressions known to be in AC, e.g. a
+ *     variable just loaded from that is also known to hold a constant.
+ *     Whoever changes acstate must update these, too.
+ *
+ * inac(value)
+ *     Check if the expression with the given value is in AC, i.e. if
+ *     it is acstate or one of its aliases.
+ *
+ * addalias(value)
+ *     Note that the expression with the given value is in AC, too.
+ *     If AC does not hold anything known, it becomes acstate.
  */
 extern void push(struct expr *);
 extern void forcepush(struct expr *);
 extern void pop(struct expr *);
 extern struct expr acstate;
+extern unsigned short aliases[MAXALIAS];
+extern unsigned char nalias;
+extern int inac(int);
+extern void addalias(int);
 
 /*
  * State management.